@@ -247,8 +247,13 @@ HalfedgeMesh::~HalfedgeMesh()
 void HalfedgeMesh::sync()
 {
     if (!global_inconsistent) {
-        // Synchronize the inconsistent element
-        const auto sync_vertex = [this](Vertex* vertex) {
+        // Synchronize the inconsistent element. Vertices are only moved here, so the BVH of
+        // the object keeps its topology and is marked for a refit if any of them has moved.
+        // The refit itself is deferred until the BVH is used, since this runs every frame
+        // while a vertex is dragged.
+        bool moved             = false;
+        const auto sync_vertex = [this, &moved](Vertex* vertex) {
+            moved = moved || mesh.vertex(v_indices[vertex]) != vertex->pos;
             mesh.VAO.bind();
             mesh.vertices.update(v_indices[vertex], vertex->pos);
             mesh.VAO.release();
@@ -283,10 +288,15 @@ void HalfedgeMesh::sync()
         visit(
             overloaded{[]([[maybe_unused]] monostate empty) {}, sync_vertex, sync_edge, sync_face},
             inconsistent_element);
+        if (moved) {
+            ++object.mesh_version;
+            object.invalidate_BVH(false);
+        }
         return;
     }
 
     logger->info("synchronize halfedge mesh to object {} (ID: {})", object.name, object.id);
+    ++object.mesh_version;
     vector<unsigned int>& mesh_faces = mesh.faces.data;
 
     unordered_map<Vertex*, unsigned int> vertex_to_index;
@@ -341,6 +351,9 @@ void HalfedgeMesh::sync()
     regenerate_halfedge_arrows();
     logger->debug("halfedge arrows are regenerated");
     global_inconsistent = false;
+    // Faces are renumbered, so the BVH has to be rebuilt rather than refitted. Several edits
+    // are often made in a row, so it is only rebuilt the next time it is used.
+    object.invalidate_BVH(true);
     logger->info("synchronization done");
     logger->info("");
 }
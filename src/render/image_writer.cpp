@@ -0,0 +1,270 @@
+#include "image_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#include <fmt/format.h>
+
+#include "simd.h"
+#include "../utils/logger.h"
+
+using Eigen::Vector3f;
+using std::size_t;
+using std::string;
+using std::uint32_t;
+using std::vector;
+using std::chrono::steady_clock;
+using duration   = std::chrono::duration<float>;
+using time_point = std::chrono::time_point<steady_clock, duration>;
+
+namespace {
+
+// CRC-32 used by PNG chunks, see the appendix of the PNG specification
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> result{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1u) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            result[n] = c;
+        }
+        return result;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xffu] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void append_u32(vector<unsigned char>& out, uint32_t value)
+{
+    out.push_back(static_cast<unsigned char>(value >> 24));
+    out.push_back(static_cast<unsigned char>(value >> 16));
+    out.push_back(static_cast<unsigned char>(value >> 8));
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+// 写入一个 PNG chunk ：长度、类型、数据和 CRC
+void append_chunk(vector<unsigned char>& out, const char* type, const vector<unsigned char>& data)
+{
+    append_u32(out, static_cast<uint32_t>(data.size()));
+    const size_t type_begin = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    append_u32(out, crc32(out.data() + type_begin, out.size() - type_begin));
+}
+
+// Encode an 8-bit RGB image as PNG. The zlib stream consists of stored (uncompressed)
+// deflate blocks: rendered images are written for inspection rather than storage, and
+// skipping compression keeps the encoder as fast as writing a PPM.
+vector<unsigned char> encode_png(const vector<unsigned char>& rgb, int width, int height)
+{
+    const size_t row_size = 3 * static_cast<size_t>(width);
+    // every scanline starts with a filter type byte, 0 means no filtering
+    vector<unsigned char> scanlines;
+    scanlines.reserve((row_size + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        scanlines.push_back(0);
+        const auto row = rgb.begin() + static_cast<std::ptrdiff_t>(y * row_size);
+        scanlines.insert(scanlines.end(), row, row + static_cast<std::ptrdiff_t>(row_size));
+    }
+
+    constexpr size_t max_block_size = 65535;
+    vector<unsigned char> zlib_stream = {0x78, 0x01};
+    zlib_stream.reserve(scanlines.size() + scanlines.size() / max_block_size * 5 + 16);
+    size_t offset = 0;
+    do {
+        const size_t block_size = std::min(max_block_size, scanlines.size() - offset);
+        const bool final_block  = offset + block_size == scanlines.size();
+        const auto len          = static_cast<uint32_t>(block_size);
+        const uint32_t nlen     = ~len & 0xffffu;
+        zlib_stream.push_back(final_block ? 1 : 0);
+        zlib_stream.push_back(static_cast<unsigned char>(len));
+        zlib_stream.push_back(static_cast<unsigned char>(len >> 8));
+        zlib_stream.push_back(static_cast<unsigned char>(nlen));
+        zlib_stream.push_back(static_cast<unsigned char>(nlen >> 8));
+        const auto block = scanlines.begin() + static_cast<std::ptrdiff_t>(offset);
+        zlib_stream.insert(zlib_stream.end(), block,
+                           block + static_cast<std::ptrdiff_t>(block_size));
+        offset += block_size;
+    } while (offset < scanlines.size());
+    // Adler-32 checksum of the uncompressed data, 5552 is the largest number of bytes
+    // that can be summed before the 32-bit accumulators overflow
+    uint32_t a = 1, b = 0;
+    for (size_t begin = 0; begin < scanlines.size(); begin += 5552) {
+        const size_t end = std::min(begin + 5552, scanlines.size());
+        for (size_t i = begin; i < end; ++i) {
+            a += scanlines[i];
+            b += a;
+        }
+        a %= 65521u;
+        b %= 65521u;
+    }
+    append_u32(zlib_stream, (b << 16) | a);
+
+    vector<unsigned char> header;
+    append_u32(header, static_cast<uint32_t>(width));
+    append_u32(header, static_cast<uint32_t>(height));
+    // bit depth 8, color type 2 (RGB), default compression, filtering and no interlacing
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+
+    vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    append_chunk(png, "IHDR", header);
+    append_chunk(png, "IDAT", zlib_stream);
+    append_chunk(png, "IEND", {});
+    return png;
+}
+
+const char* extension(ImageFormat format)
+{
+    switch (format) {
+    case ImageFormat::PPM: return ".ppm";
+    case ImageFormat::PNG: return ".png";
+    case ImageFormat::RAW_FLOAT: return ".pfm";
+    default: return "";
+    }
+}
+
+} // namespace
+
+ImageWriter::ImageWriter() : format(ImageFormat::PPM), busy(false), stopping(false)
+{
+    logger = get_logger("Image Writer");
+    worker = std::thread(&ImageWriter::worker_loop, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_submitted.notify_one();
+    worker.join();
+}
+
+// 把帧缓冲中的所有通道视为一个连续的 float 数组，每次转换 FloatLanes::width 个通道
+void ImageWriter::to_bytes(const vector<Vector3f>& frame_buf, float max_value,
+                           vector<unsigned char>& bytes)
+{
+    const size_t n      = 3 * frame_buf.size();
+    const float* in     = frame_buf.empty() ? nullptr : frame_buf.front().data();
+    const float scale   = 255.0f / max_value;
+    const FloatLanes k  = FloatLanes::broadcast(scale);
+    const FloatLanes lo = FloatLanes::broadcast(0.0f);
+    const FloatLanes hi = FloatLanes::broadcast(255.0f);
+    bytes.resize(n);
+    size_t i = 0;
+    for (; i + FloatLanes::width <= n; i += FloatLanes::width) {
+        min(max(FloatLanes::load(in + i) * k, lo), hi).store_bytes(bytes.data() + i);
+    }
+    for (; i < n; ++i) {
+        bytes[i] = static_cast<unsigned char>(std::min(std::max(in[i] * scale, 0.0f), 255.0f));
+    }
+}
+
+void ImageWriter::write(const string& name, int width, int height,
+                        const vector<unsigned char>& bytes, const vector<Vector3f>& frame_buf,
+                        float max_value)
+{
+    if (format == ImageFormat::NONE) {
+        return;
+    }
+    Job job{name + extension(format), format, width, height, {}, {}};
+    if (format == ImageFormat::RAW_FLOAT) {
+        job.floats.resize(3 * frame_buf.size());
+        for (size_t i = 0; i < frame_buf.size(); ++i) {
+            const Vector3f normalized = frame_buf[i] / max_value;
+            std::memcpy(&job.floats[3 * i], normalized.data(), 3 * sizeof(float));
+        }
+    } else {
+        job.bytes = bytes;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    job_submitted.notify_one();
+}
+
+void ImageWriter::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    job_done.wait(lock, [this]() { return jobs.empty() && !busy; });
+}
+
+void ImageWriter::worker_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        job_submitted.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        // finish all submitted images before exiting
+        if (jobs.empty()) {
+            return;
+        }
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        busy = true;
+        lock.unlock();
+
+        time_point begin_time = steady_clock::now();
+        if (write_file(job)) {
+            duration writing_duration = steady_clock::now() - begin_time;
+            logger->info("{} saved ({}x{}, {:.6f} seconds)", job.path, job.width, job.height,
+                         writing_duration.count());
+        } else {
+            logger->error("failed to write {}", job.path);
+        }
+
+        lock.lock();
+        busy = false;
+        job_done.notify_all();
+    }
+}
+
+bool ImageWriter::write_file(const Job& job)
+{
+    std::ofstream file(job.path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    const size_t row_size = 3 * static_cast<size_t>(job.width);
+    switch (job.format) {
+    case ImageFormat::PPM: {
+        file << "P6\n" << job.width << ' ' << job.height << "\n255\n";
+        file.write(reinterpret_cast<const char*>(job.bytes.data()),
+                   static_cast<std::streamsize>(job.bytes.size()));
+        break;
+    }
+    case ImageFormat::PNG: {
+        const vector<unsigned char> png = encode_png(job.bytes, job.width, job.height);
+        file.write(reinterpret_cast<const char*>(png.data()),
+                   static_cast<std::streamsize>(png.size()));
+        break;
+    }
+    case ImageFormat::RAW_FLOAT: {
+        // a negative scale means little-endian floats, and rows are stored from bottom to top
+        const uint32_t probe = 1;
+        unsigned char first_byte;
+        std::memcpy(&first_byte, &probe, 1);
+        file << "PF\n"
+             << job.width << ' ' << job.height << '\n'
+             << (first_byte == 1 ? "-1.0" : "1.0") << '\n';
+        for (int y = job.height - 1; y >= 0; --y) {
+            file.write(reinterpret_cast<const char*>(job.floats.data() + y * row_size),
+                       static_cast<std::streamsize>(row_size * sizeof(float)));
+        }
+        break;
+    }
+    default: break;
+    }
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,112 @@
+#ifndef DANDELION_RENDER_IMAGE_WRITER_H
+#define DANDELION_RENDER_IMAGE_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Core>
+#include <spdlog/spdlog.h>
+
+/*!
+ * \file render/image_writer.h
+ * \ingroup rendering
+ * \~chinese
+ * \brief 把渲染结果保存为图片文件的后台写入器。
+ */
+
+/*!
+ * \ingroup rendering
+ * \~chinese
+ * \brief 渲染结果的输出格式
+ */
+enum class ImageFormat
+{
+    /*! \~chinese 不输出文件 */
+    NONE,
+    /*! \~chinese 二进制 PPM (P6) ，扩展名为 .ppm */
+    PPM,
+    /*! \~chinese 不压缩的 PNG ，扩展名为 .png */
+    PNG,
+    /*! \~chinese 每个通道一个 32 位浮点数的 Portable Float Map ，扩展名为 .pfm */
+    RAW_FLOAT
+};
+
+/*!
+ * \ingroup rendering
+ * \~chinese
+ * \brief 在后台线程中把渲染结果写入文件
+ *
+ * 渲染器先调用 `to_bytes` 把帧缓冲转换成预览用的 8 位 RGB 数据，再调用 `write` 提交写入任务。
+ * `write` 只复制所选格式需要的数据，编码和文件 IO 都在写入器自己的线程中按提交顺序完成，
+ * 不会占用渲染线程池，也不会阻塞渲染结果的预览。
+ */
+class ImageWriter
+{
+public:
+    ImageWriter();
+    ImageWriter(const ImageWriter& other) = delete;
+    /*! \~chinese 写完所有已提交的图片后退出后台线程 */
+    ~ImageWriter();
+    /*!
+     * \~chinese
+     * \brief 把帧缓冲（按行从上到下存储）转换成 8 位 RGB 数据，使用 SIMD 指令并行处理
+     *
+     * \param frame_buf 帧缓冲
+     * \param max_value 帧缓冲中对应最大亮度的值，例如光栅化器为 255 ，光线追踪为 1
+     * \param bytes 输出的 RGB 数据，超出范围的值被截断到 \f$[0, 255]\f$
+     */
+    static void to_bytes(const std::vector<Eigen::Vector3f>& frame_buf, float max_value,
+                         std::vector<unsigned char>& bytes);
+    /*!
+     * \~chinese
+     * \brief 提交一个写入任务，格式为 `NONE` 时什么都不做
+     *
+     * \param name 不含扩展名的文件名，扩展名由 `format` 决定
+     * \param width 图片宽度
+     * \param height 图片高度
+     * \param bytes `to_bytes` 输出的 8 位 RGB 数据
+     * \param frame_buf 帧缓冲，用于输出浮点格式
+     * \param max_value 帧缓冲中对应最大亮度的值，与 `to_bytes` 相同
+     */
+    void write(const std::string& name, int width, int height,
+               const std::vector<unsigned char>& bytes,
+               const std::vector<Eigen::Vector3f>& frame_buf, float max_value);
+    /*! \~chinese 等待所有已提交的图片写入完成 */
+    void wait();
+    /*! \~chinese 输出格式，默认为 PPM */
+    ImageFormat format;
+
+private:
+    struct Job
+    {
+        std::string path;
+        ImageFormat format;
+        int width;
+        int height;
+        /*! \~chinese 8 位 RGB 数据（PPM 和 PNG）*/
+        std::vector<unsigned char> bytes;
+        /*! \~chinese 归一化的浮点 RGB 数据（PFM）*/
+        std::vector<float> floats;
+    };
+
+    void worker_loop();
+    /*! \~chinese 编码并写入一张图片，成功时返回 true */
+    static bool write_file(const Job& job);
+
+    std::deque<Job> jobs;
+    /*! \~chinese 后台线程是否正在写入图片 */
+    bool busy;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable job_submitted;
+    std::condition_variable job_done;
+    std::thread worker;
+    std::shared_ptr<spdlog::logger> logger;
+};
+
+#endif // DANDELION_RENDER_IMAGE_WRITER_H
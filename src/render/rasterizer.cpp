@@ -1,6 +1,5 @@
 #include <array>
 #include <limits>
-#include <tuple>
 #include <vector>
 #include <algorithm>
 #include <cmath>
@@ -13,6 +12,7 @@
 #include "rasterizer.h"
 #include "triangle.h"
 #include "render_engine.h"
+#include "simd.h"
 #include "../utils/math.hpp"
 
 using Eigen::Matrix4f;
@@ -20,66 +20,213 @@ using Eigen::Vector2i;
 using Eigen::Vector3f;
 using Eigen::Vector4f;
 using std::fill;
-using std::tuple;
 
-// 给定坐标(x,y)以及三角形的三个顶点坐标，判断(x,y)是否在三角形的内部
-bool Rasterizer::inside_triangle(int x, int y, const Vector4f* vertices)
+// 由三角形的三个顶点构造三条边函数，E_i(x, y) 与顶点 i 的重心坐标成正比
+template<typename VS, typename FS>
+Rasterizer<VS, FS>::EdgeFunctions::EdgeFunctions(const Vector4f* v)
 {
-    Vector3f v[3];
-    for (int i = 0; i < 3; i++) v[i] = {vertices[i].x(), vertices[i].y(), 1.0};
-
-    Vector3f p(float(x), float(y), 1.0f);
-
-    return false;
+    for (int i = 0; i < 3; i++) {
+        const Vector4f& p = v[(i + 1) % 3];
+        const Vector4f& q = v[(i + 2) % 3];
+        a[i]              = p.y() - q.y();
+        b[i]              = q.x() - p.x();
+        c[i]              = p.x() * q.y() - q.x() * p.y();
+    }
+    area = a[0] * v[0].x() + b[0] * v[0].y() + c[0];
+    // make all edge functions non-negative inside the triangle, no matter the vertices are
+    // in counterclockwise or clockwise order
+    if (area < 0.0f) {
+        for (int i = 0; i < 3; i++) {
+            a[i] = -a[i];
+            b[i] = -b[i];
+            c[i] = -c[i];
+        }
+        area = -area;
+    }
 }
 
-// 给定坐标(x,y)以及三角形的三个顶点坐标，计算(x,y)对应的重心坐标[alpha, beta, gamma]
-tuple<float, float, float> Rasterizer::compute_barycentric_2d(float x, float y, const Vector4f* v)
+// 对 mesh 的每个顶点应用一次 vertex shader ，被多个三角形共享的顶点不会被重复处理
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::shade_vertices(const GL::Mesh& mesh, VertexBuffer& buffer)
 {
-    float c1 = 0.f, c2 = 0.f, c3 = 0.f;
-    
-    // these lines below are just for compiling and can be deleted
-    (void)x;
-    (void)y;
-    (void)v;
-    // these lines above are just for compiling and can be deleted
+    const std::vector<float>& vertices = mesh.vertices.data;
+    const std::vector<float>& normals  = mesh.normals.data;
+    const size_t n_vertices            = vertices.size() / 3;
+    buffer.position.resize(n_vertices);
+    buffer.normal.resize(n_vertices);
+    buffer.world_pos.resize(n_vertices);
 
-    return {c1, c2, c3};
+    auto shade_range = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Vector4f position(vertices[3 * i], vertices[3 * i + 1], vertices[3 * i + 2],
+                                    1.0f);
+            const Vector3f normal(normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]);
+            // transform vertex position to world space for interpolating
+            buffer.world_pos[i] = (model * position).head<3>();
+            // Use vetex_shader to transform vertex attributes(position & normals) to
+            // view port
+            const VertexShaderPayload payload = vertex_shader({position, normal});
+            buffer.position[i]                = payload.position;
+            buffer.normal[i]                  = payload.normal;
+        }
+    };
+    const size_t n_workers = static_cast<size_t>(std::max(1, n_threads));
+    if (n_workers == 1) {
+        shade_range(0, n_vertices);
+        return;
+    }
+    RenderEngine::thread_pool().parallel_for(n_workers, [&](size_t worker) {
+        shade_range(n_vertices * worker / n_workers, n_vertices * (worker + 1) / n_workers);
+    });
 }
 
-// 对当前渲染物体的所有三角形面片进行遍历，进行几何变换以及光栅化
-void Rasterizer::draw(const std::vector<Triangle>& TriangleList, const GL::Material& material,
-                      const std::list<Light>& lights, const Camera& camera)
+// 从顶点缓冲中组装三角形，裁剪掉近平面之前的部分，并剔除不可见的三角形
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::assemble_triangle(const VertexBuffer& vertices,
+                                           const unsigned int* indices,
+                                           std::vector<TransformedTriangle>& output,
+                                           CullStats& stats)
 {
-    // these lines below are just for compiling and can be deleted
-    (void)material;
-    (void)lights;
-    (void)camera;
-    // these lines above are just for compiling and can be deleted
-
-    // iterate over all triangles in TriangleList
-    for (const auto& t : TriangleList) {
-        Triangle newtriangle = t;
-        (void)newtriangle;
-        
+    TransformedTriangle result;
+    // signed distances of the vertices to the near / far plane in clip space
+    float near_dist[3], far_dist[3];
+    for (int i = 0; i < 3; i++) {
+        const unsigned int index  = indices[i];
+        result.world_pos[i]       = vertices.world_pos[index];
+        result.triangle.vertex[i] = vertices.position[index];
+        result.triangle.normal[i] = vertices.normal[index];
+        const Vector4f& position  = vertices.position[index];
+        const float w             = position.w();
+        near_dist[i]              = (position.z() + 1.0f) * w;
+        far_dist[i]               = (1.0f - position.z()) * w;
+    }
+    if ((near_dist[0] < 0.0f && near_dist[1] < 0.0f && near_dist[2] < 0.0f) ||
+        (far_dist[0] < 0.0f && far_dist[1] < 0.0f && far_dist[2] < 0.0f)) {
+        ++stats.near_far;
+        return;
+    }
+    if (near_dist[0] >= 0.0f && near_dist[1] >= 0.0f && near_dist[2] >= 0.0f) {
+        if (setup_triangle(result, stats)) {
+            output.push_back(result);
+        }
+        return;
+    }
 
-        // transform vertex position to world space for interpolating
-        std::array<Vector3f, 3> worldspace_pos;
-        
+    // The triangle intersects the near plane. Clip it in homogeneous clip space, where
+    // attributes vary linearly, and the result is a triangle or a quadrilateral.
+    ++stats.clipped;
+    const Vector4f* v = result.triangle.vertex;
+    Vector4f clip_pos[3];
+    for (int i = 0; i < 3; i++) {
+        const float w = v[i].w();
+        clip_pos[i]   = Vector4f((2.0f * v[i].x() / float(width) - 1.0f) * w,
+                                 (2.0f * v[i].y() / float(height) - 1.0f) * w, v[i].z() * w, w);
+    }
+    Vector4f polygon_pos[4];
+    Vector3f polygon_world[4], polygon_normal[4];
+    int n_vertices = 0;
+    for (int i = 0; i < 3; i++) {
+        const int j = (i + 1) % 3;
+        if (near_dist[i] >= 0.0f) {
+            polygon_pos[n_vertices]    = clip_pos[i];
+            polygon_world[n_vertices]  = result.world_pos[i];
+            polygon_normal[n_vertices] = result.triangle.normal[i];
+            ++n_vertices;
+        }
+        if ((near_dist[i] >= 0.0f) != (near_dist[j] >= 0.0f)) {
+            const float s              = near_dist[i] / (near_dist[i] - near_dist[j]);
+            polygon_pos[n_vertices]    = clip_pos[i] + s * (clip_pos[j] - clip_pos[i]);
+            polygon_world[n_vertices]  = result.world_pos[i] +
+                                        s * (result.world_pos[j] - result.world_pos[i]);
+            polygon_normal[n_vertices] = (result.triangle.normal[i] +
+                                          s * (result.triangle.normal[j] -
+                                               result.triangle.normal[i]))
+                                             .normalized();
+            ++n_vertices;
+        }
+    }
+    // back to screen space, keeping w for perspective-correct interpolation
+    for (int k = 0; k < n_vertices; k++) {
+        const Vector4f& p = polygon_pos[k];
+        polygon_pos[k]    = Vector4f(0.5f * (p.x() / p.w() + 1.0f) * float(width),
+                                     0.5f * (p.y() / p.w() + 1.0f) * float(height),
+                                     p.z() / p.w(), p.w());
+    }
+    // triangulate the polygon as a fan, which keeps the winding order
+    for (int k = 1; k + 1 < n_vertices; k++) {
+        for (int i = 0; i < 3; i++) {
+            const int index           = i == 0 ? 0 : k + i - 1;
+            result.triangle.vertex[i] = polygon_pos[index];
+            result.triangle.normal[i] = polygon_normal[index];
+            result.world_pos[i]       = polygon_world[index];
+        }
+        if (setup_triangle(result, stats)) {
+            output.push_back(result);
+        }
+    }
+}
 
-        // Use vetex_shader to transform vertex attributes(position & normals) to
-        // view port and set a new triangle
-        
+// 剔除屏幕外、背面朝向相机以及不覆盖任何像素的三角形，并计算它在屏幕上覆盖的像素范围
+template<typename VS, typename FS>
+bool Rasterizer<VS, FS>::setup_triangle(TransformedTriangle& t, CullStats& stats)
+{
+    const Vector4f* v = t.triangle.vertex;
+    const float x_min = std::min({v[0].x(), v[1].x(), v[2].x()});
+    const float x_max = std::max({v[0].x(), v[1].x(), v[2].x()});
+    const float y_min = std::min({v[0].y(), v[1].y(), v[2].y()});
+    const float y_max = std::max({v[0].y(), v[1].y(), v[2].y()});
+    // discard triangles which are entirely out of the screen
+    if (!(x_max >= 0.0f && y_max >= 0.0f && x_min <= float(width - 1) &&
+          y_min <= float(height - 1))) {
+        ++stats.frustum;
+        return false;
+    }
+    // counterclockwise triangles on the screen are front-facing
+    const float signed_area = (v[1].x() - v[0].x()) * (v[2].y() - v[0].y()) -
+                              (v[2].x() - v[0].x()) * (v[1].y() - v[0].y());
+    if (backface_culling && signed_area < 0.0f) {
+        ++stats.backface;
+        return false;
+    }
+    // pixels are sampled at integer coordinates
+    if (signed_area == 0.0f || std::ceil(x_min) > std::floor(x_max) ||
+        std::ceil(y_min) > std::floor(y_max)) {
+        ++stats.zero_coverage;
+        return false;
+    }
+    t.x_min = std::max(0, static_cast<int>(std::floor(x_min)));
+    t.x_max = std::min(width - 1, static_cast<int>(std::ceil(x_max)));
+    t.y_min = std::max(0, static_cast<int>(std::floor(y_min)));
+    t.y_max = std::min(height - 1, static_cast<int>(std::ceil(y_max)));
+    return true;
+}
 
-        // call rasterize_triangle()
-        
+// 对当前渲染物体的所有三角形面片进行遍历，组装三角形并进行光栅化
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::draw(const VertexBuffer& vertices, const std::vector<unsigned int>& faces,
+                              const GL::Material& material, const std::list<Light>& lights,
+                              const Camera& camera)
+{
+    // bind material, lights and camera once for all fragments of this draw
+    const UniformBlock uniforms(material, lights, camera, material_id);
+    std::vector<TransformedTriangle> transformed;
+    // iterate over all triangles referred by the index array
+    for (size_t i = 0; i + 2 < faces.size(); i += 3) {
+        transformed.clear();
+        assemble_triangle(vertices, &faces[i], transformed, cull_stats);
+        for (const auto& visible : transformed) {
+            rasterize_triangle(visible.triangle, visible.world_pos, uniforms);
+        }
     }
 }
 
 // 对顶点的某一属性插值
-Vector3f Rasterizer::interpolate(float alpha, float beta, float gamma, const Eigen::Vector3f& vert1,
-                                 const Eigen::Vector3f& vert2, const Eigen::Vector3f& vert3,
-                                 const Eigen::Vector3f& weight, const float& Z)
+template<typename VS, typename FS>
+Vector3f Rasterizer<VS, FS>::interpolate(float alpha, float beta, float gamma,
+                                         const Eigen::Vector3f& vert1,
+                                         const Eigen::Vector3f& vert2,
+                                         const Eigen::Vector3f& vert3,
+                                         const Eigen::Vector3f& weight, const float& Z)
 {
     Vector3f interpolated_res;
     for (int i = 0; i < 3; i++) {
@@ -91,56 +238,249 @@ Vector3f Rasterizer::interpolate(float alpha, float beta, float gamma, const Eig
 }
 
 // 对当前三角形进行光栅化
-void Rasterizer::rasterize_triangle(const Triangle& t, const std::array<Vector3f, 3>& world_pos,
-                                    GL::Material material, const std::list<Light>& lights,
-                                    Camera camera)
-{
-    // these lines below are just for compiling and can be deleted
-    (void)t;
-    (void)world_pos;
-    (void)material;
-    (void)lights;
-    (void)camera;
-    // these lines above are just for compiling and can be deleted
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::rasterize_triangle(const Triangle& t,
+                                            const std::array<Vector3f, 3>& world_pos,
+                                            const UniformBlock& uniforms)
+{
+    rasterize_in_range(t, world_pos, uniforms, 0, width - 1, 0, height - 1);
+}
 
+// 光栅化三角形落在给定像素范围内的部分
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::rasterize_in_range(const Triangle& t,
+                                            const std::array<Vector3f, 3>& world_pos,
+                                            const UniformBlock& uniforms, int x_min, int x_max,
+                                            int y_min, int y_max)
+{
+    const Vector4f* v = t.vertex;
     // discard all pixels out of the range(including x,y,z)
+    x_min = std::max(x_min, static_cast<int>(std::floor(std::min({v[0].x(), v[1].x(), v[2].x()}))));
+    x_max = std::min(x_max, static_cast<int>(std::ceil(std::max({v[0].x(), v[1].x(), v[2].x()}))));
+    y_min = std::max(y_min, static_cast<int>(std::floor(std::min({v[0].y(), v[1].y(), v[2].y()}))));
+    y_max = std::min(y_max, static_cast<int>(std::ceil(std::max({v[0].y(), v[1].y(), v[2].y()}))));
+    const EdgeFunctions edges(v);
+    // degenerated triangles cover no pixel
+    if (x_min > x_max || y_min > y_max || !(edges.area > 0.0f)) {
+        return;
+    }
+    const Vector3f weight(v[0].w(), v[1].w(), v[2].w());
+    // The interpolated depth is a convex combination of the vertex depths as long as all
+    // vertices are in front of the camera, so the smallest vertex depth bounds the depth of
+    // all fragments and can be tested against the coarse depth buffer.
+    const bool depth_bounded = v[0].w() > 0.0f && v[1].w() > 0.0f && v[2].w() > 0.0f;
+    const float z_min        = depth_bounded ? std::min({v[0].z(), v[1].z(), v[2].z()})
+                                             : -std::numeric_limits<float>::infinity();
+    if (occluded(z_min, x_min, x_max, y_min, y_max)) {
+        return;
+    }
+
+    constexpr int n_lanes = FloatLanes::width;
+    // E_i / area is the barycentric coordinate of vertex i, so fold 1 / area into the
+    // coefficients and step the barycentric coordinates directly.
+    const float inv_area = 1.0f / edges.area;
+    float a[3], b[3], c[3];
+    FloatLanes a_ramp[3], a_step[3], inv_w[3], z_over_w[3];
+    for (int i = 0; i < 3; i++) {
+        a[i]        = edges.a[i] * inv_area;
+        b[i]        = edges.b[i] * inv_area;
+        c[i]        = edges.c[i] * inv_area;
+        a_ramp[i]   = FloatLanes::broadcast(a[i]) * FloatLanes::ramp();
+        a_step[i]   = FloatLanes::broadcast(a[i] * float(n_lanes));
+        inv_w[i]    = FloatLanes::broadcast(1.0f / v[i].w());
+        z_over_w[i] = FloatLanes::broadcast(v[i].z() / v[i].w());
+    }
+    // the largest value of a linear function over a block is at one of its corners
+    const float block_extent = float(block_size - 1);
+    float block_max[3];
+    for (int i = 0; i < 3; i++) {
+        block_max[i] = (std::max(a[i], 0.0f) + std::max(b[i], 0.0f)) * block_extent;
+    }
 
-    
-    
-    // if current pixel is in current triange:
-    // 1. interpolate depth(use projection correction algorithm)
-    // 2. interpolate vertex positon & normal(use function:interpolate())
-    // 3. fragment shading(use function:fragment_shader())
-    // 4. set pixel
-            
+    float alpha[n_lanes], beta[n_lanes], gamma[n_lanes], Z[n_lanes], z[n_lanes];
+    for (int block_y = y_min / block_size * block_size; block_y <= y_max; block_y += block_size) {
+        for (int block_x = x_min / block_size * block_size; block_x <= x_max;
+             block_x += block_size) {
+            // reject the whole block if it lies outside any of the three edges
+            bool outside = false;
+            for (int i = 0; i < 3; i++) {
+                const float corner = a[i] * float(block_x) + b[i] * float(block_y) + c[i];
+                outside            = outside || corner + block_max[i] < 0.0f;
+            }
+            // reject the whole block if it is occluded
+            if (outside || z_min >= coarse_depth_buf[get_block_index(block_x, block_y)]) {
+                continue;
+            }
+            bool depth_written = false;
+            const int x_begin = std::max(block_x, x_min);
+            const int x_end   = std::min(block_x + block_size - 1, x_max);
+            const int y_end   = std::min(block_y + block_size - 1, y_max);
+            for (int y = std::max(block_y, y_min); y <= y_end; y++) {
+                // edge functions of the first n_lanes pixels of this row, stepped
+                // incrementally along the row
+                FloatLanes e[3];
+                for (int i = 0; i < 3; i++) {
+                    const float e_begin = a[i] * float(x_begin) + b[i] * float(y) + c[i];
+                    e[i]                = FloatLanes::broadcast(e_begin) + a_ramp[i];
+                }
+                for (int x = x_begin; x <= x_end; x += n_lanes) {
+                    const FloatLanes bary[3] = {e[0], e[1], e[2]};
+                    for (int i = 0; i < 3; i++) {
+                        e[i] = e[i] + a_step[i];
+                    }
+                    const int n_valid = std::min(n_lanes, x_end - x + 1);
+                    const int mask    = bary[0].non_negative_mask() &
+                                     bary[1].non_negative_mask() &
+                                     bary[2].non_negative_mask() & ((1 << n_valid) - 1);
+                    if (mask == 0) {
+                        continue;
+                    }
+                    // interpolate depth for all lanes (use projection correction algorithm)
+                    const FloatLanes lanes_Z =
+                        FloatLanes::broadcast(1.0f) /
+                        (bary[0] * inv_w[0] + bary[1] * inv_w[1] + bary[2] * inv_w[2]);
+                    const FloatLanes lanes_z = (bary[0] * z_over_w[0] + bary[1] * z_over_w[1] +
+                                                bary[2] * z_over_w[2]) *
+                                               lanes_Z;
+                    bary[0].store(alpha);
+                    bary[1].store(beta);
+                    bary[2].store(gamma);
+                    lanes_Z.store(Z);
+                    lanes_z.store(z);
+                    for (int lane = 0; lane < n_lanes; lane++) {
+                        if (!((mask >> lane) & 1) || z[lane] < -1.0f || z[lane] > 1.0f) {
+                            continue;
+                        }
+                        const int index = get_index(x + lane, y);
+                        // early depth test skips shading fragments that will be overwritten
+                        if (early_z && !(z[lane] < depth_buf[index])) {
+                            continue;
+                        }
+                        // interpolate vertex positon & normal(use function:interpolate())
+                        const Vector3f position =
+                            interpolate(alpha[lane], beta[lane], gamma[lane], world_pos[0],
+                                        world_pos[1], world_pos[2], weight, Z[lane]);
+                        const Vector3f normal =
+                            interpolate(alpha[lane], beta[lane], gamma[lane], t.normal[0],
+                                        t.normal[1], t.normal[2], weight, Z[lane])
+                                .normalized();
+                        // fragment shading(use function:fragment_shader())
+                        const FragmentOutput output =
+                            fragment_shader(FragmentShaderPayload(position, normal), uniforms);
+                        // set pixel
+                        if (z[lane] < depth_buf[index]) {
+                            depth_buf[index] = z[lane];
+                            write_fragment(x + lane, y, output);
+                            depth_written = true;
+                        }
+                    }
+                }
+            }
+            if (depth_written) {
+                update_coarse_depth(block_x, block_y);
+            }
+        }
+    }
 }
 
 // 初始化整个光栅化渲染器
-void Rasterizer::clear(BufferType buff)
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::clear(BufferType buff)
 {
     if ((buff & BufferType::Color) == BufferType::Color) {
         fill(frame_buf.begin(), frame_buf.end(), RenderEngine::background_color * 255.0f);
+        fill(g_buffer.begin(), g_buffer.end(),
+             GBufferTexel{Vector3f::Zero(), Vector3f::Zero(), -1});
     }
     if ((buff & BufferType::Depth) == BufferType::Depth) {
         fill(depth_buf.begin(), depth_buf.end(), std::numeric_limits<float>::infinity());
+        fill(coarse_depth_buf.begin(), coarse_depth_buf.end(),
+             std::numeric_limits<float>::infinity());
     }
 }
 
-Rasterizer::Rasterizer(int w, int h) : width(w), height(h)
+template<typename VS, typename FS>
+Rasterizer<VS, FS>::Rasterizer(int w, int h)
+    : width(w), height(h), n_threads(1), early_z(true), backface_culling(false), material_id(0)
 {
     frame_buf.resize(w * h);
     depth_buf.resize(w * h);
+    if constexpr (writes_g_buffer) {
+        g_buffer.resize(w * h);
+    }
+    const int n_blocks_x = (w + block_size - 1) / block_size;
+    const int n_blocks_y = (h + block_size - 1) / block_size;
+    coarse_depth_buf.resize(n_blocks_x * n_blocks_y);
 }
 
 // 给定像素坐标(x,y)，计算frame buffer里对应的index
-int Rasterizer::get_index(int x, int y)
+template<typename VS, typename FS>
+int Rasterizer<VS, FS>::get_index(int x, int y)
 {
     return (height - 1 - y) * width + x;
 }
 
+// 给定像素坐标(x,y)，计算所在像素块在coarse depth buffer里对应的index
+template<typename VS, typename FS>
+int Rasterizer<VS, FS>::get_block_index(int x, int y)
+{
+    const int n_blocks_x = (width + block_size - 1) / block_size;
+    return (y / block_size) * n_blocks_x + x / block_size;
+}
+
+// 查询coarse depth buffer，判断给定范围内是否所有像素都比z_min更近
+template<typename VS, typename FS>
+bool Rasterizer<VS, FS>::occluded(float z_min, int x_min, int x_max, int y_min, int y_max)
+{
+    for (int y = y_min / block_size * block_size; y <= y_max; y += block_size) {
+        for (int x = x_min / block_size * block_size; x <= x_max; x += block_size) {
+            if (z_min < coarse_depth_buf[get_block_index(x, y)]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// 重新计算(x,y)所在像素块的最大深度
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::update_coarse_depth(int x, int y)
+{
+    const int x_begin = x / block_size * block_size;
+    const int y_begin = y / block_size * block_size;
+    const int x_end   = std::min(x_begin + block_size, width);
+    const int y_end   = std::min(y_begin + block_size, height);
+    float max_depth   = -std::numeric_limits<float>::infinity();
+    for (int j = y_begin; j < y_end; j++) {
+        const int row = get_index(x_begin, j);
+        for (int i = 0; i < x_end - x_begin; i++) {
+            max_depth = std::max(max_depth, depth_buf[row + i]);
+        }
+    }
+    coarse_depth_buf[get_block_index(x, y)] = max_depth;
+}
+
 // 给定像素点以及fragement shader得到的结果，对frame buffer中对应存储位置进行赋值
-void Rasterizer::set_pixel(const Vector2i& point, const Vector3f& res)
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::set_pixel(const Vector2i& point, const Vector3f& res)
 {
     int idx        = get_index(point.x(), point.y());
     frame_buf[idx] = res;
 }
+
+// 将通过深度测试的片元写入frame buffer或G-buffer
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::write_fragment(int x, int y, const Vector3f& color)
+{
+    set_pixel(Vector2i(x, y), color);
+}
+
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::write_fragment(int x, int y, const GBufferTexel& texel)
+{
+    g_buffer[get_index(x, y)] = texel;
+}
+
+// 显式实例化渲染器使用的 shader 组合，定义在 rasterizer_mt.cpp 中的成员函数在该文件中实例化
+template class Rasterizer<VertexShader, PhongFragmentShader>;
+template class Rasterizer<VertexShader, GBufferShader>;
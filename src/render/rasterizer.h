@@ -2,8 +2,11 @@
 #define DANDELION_RENDER_RASTERIZER_MT_H
 
 #include <algorithm>
+#include <array>
+#include <cstddef>
 #include <functional>
 #include <map>
+#include <type_traits>
 #include <vector>
 #include <list>
 
@@ -44,6 +47,53 @@ inline BufferType operator&(BufferType a, BufferType b)
     return BufferType((int)a & (int)b);
 }
 
+/*!
+ * \~chinese
+ * \brief 几何阶段因各种原因被剔除（或被裁剪）的三角形数量
+ */
+struct CullStats
+{
+    /*! \~chinese 完全位于近平面之前或远平面之后 */
+    std::size_t near_far = 0;
+    /*! \~chinese 投影到屏幕后完全位于屏幕之外 */
+    std::size_t frustum = 0;
+    /*! \~chinese 背面朝向相机（只在开启背面剔除时统计） */
+    std::size_t backface = 0;
+    /*! \~chinese 面积为 0 或者没有覆盖任何像素采样点 */
+    std::size_t zero_coverage = 0;
+    /*! \~chinese 与近平面相交、被裁剪为一个或两个三角形（这些三角形没有被剔除） */
+    std::size_t clipped = 0;
+
+    CullStats& operator+=(const CullStats& other)
+    {
+        near_far += other.near_far;
+        frustum += other.frustum;
+        backface += other.backface;
+        zero_coverage += other.zero_coverage;
+        clipped += other.clipped;
+        return *this;
+    }
+};
+
+/*!
+ * \ingroup rendering
+ * \~chinese
+ * \brief 经过 vertex shader 处理的顶点缓冲 (post-transform vertex buffer)
+ *
+ * 与 `GL::Mesh` 的顶点数组一一对应，三角形通过 mesh 的索引数组引用其中的顶点，
+ * 因此被多个三角形共享的顶点只需要处理一次。缓冲可以跨帧保存，只要物体的 mesh 、
+ * 变换矩阵和成像平面尺寸都没有变化就可以直接复用。
+ */
+struct VertexBuffer
+{
+    /*! \~chinese 屏幕空间下的顶点坐标，w 分量保留了裁剪空间的 w 用于透视矫正插值 */
+    std::vector<Eigen::Vector4f> position;
+    /*! \~chinese world space 下的顶点法线 */
+    std::vector<Eigen::Vector3f> normal;
+    /*! \~chinese world space 下的顶点坐标 */
+    std::vector<Eigen::Vector3f> world_pos;
+};
+
 /*!
  * \ingroup rendering
  * \~chinese
@@ -51,7 +101,18 @@ inline BufferType operator&(BufferType a, BufferType b)
  *
  * 这个类主要由光栅化所需的各种属性（如成像平面的长宽，以及M,V,P矩阵等），以及光栅化
  * 整个流程所需的各种操作对应的函数构成（如vertex shader, fragment shader,等）
+ *
+ * vertex shader 和 fragment shader 以模板参数的形式指定，逐顶点、逐片元的调用都是
+ * 对函数对象的直接调用，可以被编译器内联。可用的组合在 rasterizer.cpp 末尾显式实例化。
+ *
+ * \tparam VS vertex shader 函数对象类型，签名为
+ * `VertexShaderPayload(const VertexShaderPayload&)`
+ * \tparam FS fragment shader 函数对象类型，签名为
+ * `Eigen::Vector3f(const FragmentShaderPayload&, const UniformBlock&)` 时输出颜色到
+ * frame buffer ；签名为 `GBufferTexel(const FragmentShaderPayload&, const UniformBlock&)`
+ * 时输出几何信息到 G-buffer ，用于延迟着色
  */
+template<typename VS = VertexShader, typename FS = PhongFragmentShader>
 class Rasterizer
 {
 public:
@@ -59,19 +120,49 @@ public:
     Rasterizer(int w, int h);
 
     int width, height;
+    /*! \~chinese 多线程光栅化（`draw_mt`）时使用的线程数，由 `RenderEngine::n_threads` 设置 */
+    int n_threads;
+    /*! \~chinese 多线程光栅化时屏幕分块 (tile) 的边长（以像素计） */
+    static constexpr int tile_size = 32;
+    /*!
+     * \~chinese
+     * \brief 光栅化时整块剔除的像素块边长
+     *
+     * 一个像素块完全位于三角形某条边外侧时直接跳过，块内的像素按 `FloatLanes::width`
+     * 个一组同时做覆盖测试和重心坐标计算。
+     */
+    static constexpr int block_size = 8;
+    /*!
+     * \~chinese
+     * \brief 是否在执行 fragment shader 之前做深度测试 (early-z)
+     *
+     * 开启时不能通过深度测试的片元不会被着色；关闭时先着色再做深度测试。
+     * 两种模式的渲染结果相同，只要 fragment shader 没有副作用。
+     */
+    bool early_z;
+    /*!
+     * \~chinese
+     * \brief 是否剔除背面朝向相机的三角形
+     *
+     * 屏幕上顶点按逆时针排列的一面为正面，与 OpenGL 的默认设置相同。
+     * 只应对封闭的网格开启，否则从背面观察开放的网格（例如平面）时它会消失。
+     */
+    bool backface_culling;
+    /*! \~chinese 自构造以来几何阶段剔除的三角形数量 */
+    CullStats cull_stats;
 
+    /*! \~chinese 当前渲染物体的材质编号，只有输出到 G-buffer 时才会被用到 */
+    int material_id;
     /*! \~chinese 当前渲染物体的model矩阵 */
     Eigen::Matrix4f model;
     /*! \~chinese 当前相机的view矩阵 */
     Eigen::Matrix4f view;
     /*! \~chinese 当前相机的projection矩阵 */
     Eigen::Matrix4f projection;
-    /*! \~chinese 指定使用的vertex shader */
-    std::function<VertexShaderPayload(VertexShaderPayload)> vertex_shader;
-    /*! \~chinese 指定使用的fragment shader */
-    std::function<Eigen::Vector3f(FragmentShaderPayload, GL::Material, const std::list<Light>&,
-                                  Camera)>
-        fragment_shader;
+    /*! \~chinese 使用的vertex shader */
+    VS vertex_shader;
+    /*! \~chinese 使用的fragment shader */
+    FS fragment_shader;
     /*!
      * \~chinese
      * \brief 设置当前像素点的颜色
@@ -84,23 +175,46 @@ public:
      */
     void set_pixel(const Eigen::Vector2i& point, const Eigen::Vector3f& color);
 
+    /*!
+     * \~chinese
+     * \brief 对 mesh 的每个顶点应用一次 vertex shader ，结果写入 `buffer`
+     *
+     * 对顶点的坐标和法线方向进行变换，同时计算顶点在 world space 下的坐标便于后续的插值操作。
+     * 使用当前的 `model` 矩阵以及 `Uniforms` 中的 MVP 矩阵和成像平面尺寸，
+     * `n_threads` 大于 1 时由线程池并行处理。
+     */
+    void shade_vertices(const GL::Mesh& mesh, VertexBuffer& buffer);
     /*!
      * \~chinese
      * \brief 对整个物体进行光栅化渲染
      *
-     * 对物体的所有三角形面片进行遍历，对三角形的顶点应用vertex shader，对顶点的坐标和法线方向
-     * 进行变化；同时获取三角形每个顶点在view space下的坐标便于后续的插值操作；对顶点的法线同样
-     * 需要变换到view space下用于后续的插值，最后执行光栅化
+     * 按索引数组遍历物体的所有三角形面片，从已经处理过的顶点缓冲中取出三个顶点组装成三角形，
+     * 经过裁剪和剔除后进行光栅化。
+     *
+     * 材质、光源和相机在开始绘制时被打包成一个 `UniformBlock` ，之后所有片元共享这一份数据。
      *
-     * \param TriangleList 存储了当前渲染物体的所有三角形面片
+     * \param vertices 由 `shade_vertices` 处理过的顶点缓冲
+     * \param faces 三角形面片的顶点索引，每三个一组（即 `GL::Mesh::faces` 的数据）
      * \param material 当前渲染物体的材质
      * \param lights 存储了当前场景中的所有光源
      * \param camera 当前使用的相机（观察点）
      */
-    void draw(const std::vector<Triangle>& TriangleList, const GL::Material& material,
-              const std::list<Light>& lights, const Camera& camera);
-    void draw_mt(const std::vector<Triangle>& TriangleList, const GL::Material& material,
-                 const std::list<Light>& lights, const Camera& camera);
+    void draw(const VertexBuffer& vertices, const std::vector<unsigned int>& faces,
+              const GL::Material& material, const std::list<Light>& lights, const Camera& camera);
+    /*!
+     * \~chinese
+     * \brief 对整个物体进行多线程光栅化渲染
+     *
+     * 采用 sort-middle 的流水线：首先由各线程并行地组装、裁剪和剔除三角形，
+     * 并将得到的三角形按屏幕空间包围盒分配 (binning) 到各个屏幕分块中；
+     * 然后每个分块只交给一个线程光栅化。由于任意两个线程不会写入同一个像素，
+     * 写 frame buffer 和 depth buffer 时无需加锁。
+     *
+     * 参数含义与 `draw` 相同，使用的线程数由 `n_threads` 决定。
+     */
+    void draw_mt(const VertexBuffer& vertices, const std::vector<unsigned int>& faces,
+                 const GL::Material& material, const std::list<Light>& lights,
+                 const Camera& camera);
 
     /*!
      * \~chinese
@@ -116,8 +230,81 @@ public:
     std::vector<Eigen::Vector3f> frame_buf;
     /*! \~chinese depth buffer也可以叫做z-buffer，用于判断像素点相较于观察点的前后关系 */
     std::vector<float> depth_buf;
+    /*!
+     * \~chinese
+     * \brief 层次深度缓冲 (Hi-Z) 的粗糙层，记录每个像素块内 depth buffer 的最大值
+     *
+     * 像素块的边长为 `block_size` ，按屏幕坐标从下到上、从左到右存储。一个三角形在某个像素块
+     * 内的最小深度不小于这个最大值时，它在这个块内不可能通过深度测试，可以整块跳过。
+     */
+    std::vector<float> coarse_depth_buf;
+    /*!
+     * \~chinese
+     * \brief 延迟着色使用的 G-buffer ，存储每个像素可见片元的位置、法线和材质编号
+     *
+     * 只有 fragment shader 的输出为 `GBufferTexel` 时才会分配，索引方式与 frame buffer 相同。
+     */
+    std::vector<GBufferTexel> g_buffer;
 
 private:
+    /*! \~chinese fragment shader 的输出类型 */
+    using FragmentOutput =
+        std::invoke_result_t<const FS&, const FragmentShaderPayload&, const UniformBlock&>;
+    /*! \~chinese 是否输出到 G-buffer */
+    static constexpr bool writes_g_buffer = std::is_same_v<FragmentOutput, GBufferTexel>;
+
+    /*!
+     * \~chinese
+     * \brief 经过几何阶段处理、等待光栅化的三角形
+     *
+     * 多线程光栅化时，几何阶段的结果需要暂存下来，再按屏幕分块分配给各个线程。
+     */
+    struct TransformedTriangle
+    {
+        /*! \~chinese 顶点已经变换到屏幕空间的三角形 */
+        Triangle triangle;
+        /*! \~chinese 三个顶点在 world space 下的坐标 */
+        std::array<Eigen::Vector3f, 3> world_pos;
+        ///@{
+        /*! \~chinese 三角形在屏幕上覆盖的像素范围（闭区间，已经截断到屏幕内） */
+        int x_min, x_max, y_min, y_max;
+        ///@}
+    };
+    ///@{
+    /*!
+     * \~chinese
+     * \brief `draw_mt` 各线程的三角形和分块列表，`tile_bins[worker * n_tiles + tile]`
+     * 是第 worker 个线程分配到第 tile 个分块的三角形在 `worker_triangles[worker]` 中的序号
+     *
+     * 它们在多次绘制之间保留，只在线程数或分块数改变时重新分配。每个分块的列表在光栅化
+     * 完这个分块后被清空，因此每次绘制开始时所有列表都是空的，但仍保有之前分配的内存。
+     */
+    std::vector<std::vector<TransformedTriangle>> worker_triangles;
+    std::vector<std::vector<size_t>> tile_bins;
+    ///@}
+    /*!
+     * \~chinese
+     * \brief 几何阶段：从顶点缓冲中组装三角形，然后做裁剪和剔除
+     *
+     * 屏幕的上下左右四个方向依靠光栅化时对像素范围的截断处理（guard-band），不做裁剪；
+     * 与近平面相交的三角形在齐次裁剪空间中被裁剪，超出远平面的片元在光栅化时逐像素丢弃。
+     * 完全在近平面之前或远平面之后、完全在屏幕之外、背面朝向相机（如果开启了背面剔除）
+     * 以及没有覆盖任何像素的三角形被剔除，并计入 `stats` 。
+     *
+     * \param vertices 已经处理过的顶点缓冲
+     * \param indices 三角形三个顶点在缓冲中的索引
+     * \param output 没有被剔除的三角形（0 到 2 个）被追加到它的末尾
+     * \param stats 剔除统计
+     */
+    void assemble_triangle(const VertexBuffer& vertices, const unsigned int* indices,
+                           std::vector<TransformedTriangle>& output, CullStats& stats);
+    /*!
+     * \~chinese
+     * \brief 对一个已经变换到屏幕空间的三角形做剔除测试，并计算它在屏幕上覆盖的像素范围
+     *
+     * \returns 三角形被剔除时返回 false
+     */
+    bool setup_triangle(TransformedTriangle& t, CullStats& stats);
     /*!
      * \~chinese
      * \brief 光栅化当前三角形
@@ -129,21 +316,48 @@ private:
      *
      * \param t 当前进行光栅化的三角形
      * \param world_pos 三角形三个顶点的坐标(已经变换到world_space下)
-     * \param material 当前三角形所在物体的材质
-     * \param lights 当前场景的所有光源(已经变换到world_space下)
-     * \param camera 当前使用的相机（观察点）
+     * \param uniforms 本次绘制绑定的材质、光源和相机位置
      */
     void rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos,
-                            GL::Material material, const std::list<Light>& lights, Camera camera);
+                            const UniformBlock& uniforms);
+    /*!
+     * \~chinese
+     * \brief 在一个屏幕分块内光栅化当前三角形
+     *
+     * 与 `rasterize_triangle` 相同，但只处理落在 \f$[x_0, x_1]\times[y_0, y_1]\f$
+     * （闭区间）内的像素，多线程光栅化时每个线程只写入自己负责的分块。
+     */
     void rasterize_triangle_mt(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos,
-                               GL::Material material, const std::list<Light>& lights,
-                               Camera camera);
+                               const UniformBlock& uniforms, int x0, int x1, int y0, int y1);
+    /*!
+     * \~chinese
+     * \brief 光栅化三角形在给定像素范围（闭区间）内的部分，是单线程和多线程光栅化共用的实现
+     *
+     * 以 `block_size` 为边长遍历像素块，用边函数剔除完全在三角形外的块；块内每次用
+     * SIMD 增量地计算 `FloatLanes::width` 个像素的边函数，同时得到覆盖掩码和重心坐标。
+     * 在计算重心坐标之前，先用三角形顶点的最小深度查询 `coarse_depth_buf` ，
+     * 整个三角形或整个像素块被遮挡时直接跳过。
+     */
+    void rasterize_in_range(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos,
+                            const UniformBlock& uniforms, int x_min, int x_max, int y_min,
+                            int y_max);
 
-    /*! \~chinese 判断像素坐标(x,y)是否在给定三个顶点的三角形内 */
-    static bool inside_triangle(int x, int y, const Eigen::Vector4f* vertices);
-    /*! \~chinese 计算像素坐标(x,y)在给定三个顶点的三角形内的重心坐标 */
-    static std::tuple<float, float, float> compute_barycentric_2d(float x, float y,
-                                                                  const Eigen::Vector4f* v);
+    /*!
+     * \~chinese
+     * \brief 三角形三条边的边函数 (edge function)
+     *
+     * 第 i 条边函数 \f$E_i(x, y) = a_i x + b_i y + c_i\f$ 对应顶点 i 的对边，
+     * 它与顶点 i 的重心坐标成正比。构造时已经统一了符号，使得三角形内部的
+     * 点三个边函数都非负，因此不必区分顶点的环绕方向。
+     */
+    struct EdgeFunctions
+    {
+        /*! \~chinese 由屏幕空间的三个顶点构造边函数 */
+        explicit EdgeFunctions(const Eigen::Vector4f* v);
+        float a[3], b[3], c[3];
+        /*! \~chinese 三角形有向面积的两倍（已取正），为 0 时三角形退化 */
+        float area;
+    };
     /*!
      * \~chinese
      * \brief 对顶点的任意属性（如view space坐标，法线向量）利用屏幕空间进行插值
@@ -162,6 +376,21 @@ private:
 
     /*! \~chinese 获取给定坐标(x,y)，计算在frame buffer中对应的index */
     int get_index(int x, int y);
+    /*! \~chinese 将通过深度测试的片元的颜色写入 frame buffer */
+    void write_fragment(int x, int y, const Eigen::Vector3f& color);
+    /*! \~chinese 将通过深度测试的片元的几何信息写入 G-buffer */
+    void write_fragment(int x, int y, const GBufferTexel& texel);
+    /*! \~chinese 获取给定坐标(x,y)所在的像素块在 coarse depth buffer 中对应的index */
+    int get_block_index(int x, int y);
+    /*!
+     * \~chinese
+     * \brief 判断深度不小于 `z_min` 的片元能否在给定像素范围（闭区间）内通过深度测试
+     *
+     * 只查询 coarse depth buffer ，返回 true 时范围内的所有像素都一定不能通过深度测试。
+     */
+    bool occluded(float z_min, int x_min, int x_max, int y_min, int y_max);
+    /*! \~chinese 以 depth buffer 的内容重新计算 (x,y) 所在像素块的最大深度 */
+    void update_coarse_depth(int x, int y);
 };
 
 #endif // DANDELION_RENDER_RASTERIZER_MT_H
@@ -1,6 +1,7 @@
 #include "rasterizer.h"
 
 #include <array>
+#include <atomic>
 #include <limits>
 #include <tuple>
 #include <vector>
@@ -12,6 +13,7 @@
 #include <spdlog/spdlog.h>
 
 #include "triangle.h"
+#include "render_engine.h"
 #include "../utils/math.hpp"
 
 using Eigen::Matrix4f;
@@ -19,27 +21,104 @@ using Eigen::Vector2i;
 using Eigen::Vector3f;
 using Eigen::Vector4f;
 
-void Rasterizer::draw_mt(const std::vector<Triangle>& TriangleList, const GL::Material& material,
-                         const std::list<Light>& lights, const Camera& camera)
+// 多线程光栅化：并行组装三角形 -> 按屏幕分块分配三角形 -> 每个分块由一个线程光栅化
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::draw_mt(const VertexBuffer& vertices,
+                                 const std::vector<unsigned int>& faces,
+                                 const GL::Material& material, const std::list<Light>& lights,
+                                 const Camera& camera)
 {
-    // these lines below are just for compiling and can be deleted
-    (void)TriangleList;
-    (void)material;
-    (void)lights;
-    (void)camera;
-    // these lines above are just for compiling and can be deleted
+    // bind material, lights and camera once for all fragments of this draw
+    const UniformBlock uniforms(material, lights, camera, material_id);
+    const int n_workers  = std::max(1, n_threads);
+    const int n_tiles_x  = (width + tile_size - 1) / tile_size;
+    const int n_tiles_y  = (height + tile_size - 1) / tile_size;
+    const int n_tiles    = n_tiles_x * n_tiles_y;
+    const size_t n_faces = faces.size() / 3;
+
+    // Geometry stage. Each worker assembles a contiguous range of triangles into its own
+    // list (clipping may split one triangle into two) and bins them into its own per-tile
+    // lists, so no synchronization is needed. The lists are kept across draws and only
+    // reallocated when the number of workers or tiles changes.
+    const size_t n_bins = static_cast<size_t>(n_workers) * static_cast<size_t>(n_tiles);
+    if (worker_triangles.size() != static_cast<size_t>(n_workers) || tile_bins.size() != n_bins) {
+        worker_triangles.assign(n_workers, {});
+        tile_bins.assign(n_bins, {});
+    }
+    std::vector<CullStats> worker_stats(n_workers);
+    auto geometry_stage = [&](int worker) {
+        const size_t begin                       = n_faces * worker / n_workers;
+        const size_t end                         = n_faces * (worker + 1) / n_workers;
+        std::vector<TransformedTriangle>& output = worker_triangles[worker];
+        std::vector<size_t>* bins                = &tile_bins[worker * n_tiles];
+        output.clear();
+        output.reserve(end - begin);
+        for (size_t i = begin; i < end; i++) {
+            const size_t first = output.size();
+            assemble_triangle(vertices, &faces[3 * i], output, worker_stats[worker]);
+            for (size_t j = first; j < output.size(); j++) {
+                const TransformedTriangle& t = output[j];
+                for (int tile_y = t.y_min / tile_size; tile_y <= t.y_max / tile_size; tile_y++) {
+                    for (int tile_x = t.x_min / tile_size; tile_x <= t.x_max / tile_size;
+                         tile_x++) {
+                        bins[tile_y * n_tiles_x + tile_x].push_back(j);
+                    }
+                }
+            }
+        }
+    };
+
+    // Rasterization stage. Tiles are handed out dynamically and each tile is owned by
+    // exactly one worker, so writes to frame_buf and depth_buf never race. Visiting the
+    // bins in worker order keeps the submission order of triangles within a tile. Bins are
+    // emptied once their tile is done, which leaves them ready for the next draw.
+    std::atomic<int> next_tile(0);
+    auto raster_stage = [&]() {
+        for (int tile = next_tile++; tile < n_tiles; tile = next_tile++) {
+            const int x0 = (tile % n_tiles_x) * tile_size;
+            const int y0 = (tile / n_tiles_x) * tile_size;
+            const int x1 = std::min(x0 + tile_size, width) - 1;
+            const int y1 = std::min(y0 + tile_size, height) - 1;
+            for (int worker = 0; worker < n_workers; worker++) {
+                std::vector<size_t>& bin = tile_bins[worker * n_tiles + tile];
+                for (size_t i : bin) {
+                    const TransformedTriangle& t = worker_triangles[worker][i];
+                    rasterize_triangle_mt(t.triangle, t.world_pos, uniforms, x0, x1, y0, y1);
+                }
+                bin.clear();
+            }
+        }
+    };
+
+    ThreadPool& pool = RenderEngine::thread_pool();
+    pool.parallel_for(static_cast<size_t>(n_workers),
+                      [&](size_t worker) { geometry_stage(static_cast<int>(worker)); });
+    pool.parallel_for(static_cast<size_t>(n_workers), [&](size_t) { raster_stage(); });
+    for (const CullStats& stats : worker_stats) {
+        cull_stats += stats;
+    }
 }
 
 // Screen space rasterization
-void Rasterizer::rasterize_triangle_mt(const Triangle& t, const std::array<Vector3f, 3>& world_pos,
-                                       GL::Material material, const std::list<Light>& lights,
-                                       Camera camera)
+template<typename VS, typename FS>
+void Rasterizer<VS, FS>::rasterize_triangle_mt(const Triangle& t,
+                                               const std::array<Vector3f, 3>& world_pos,
+                                               const UniformBlock& uniforms, int x0, int x1,
+                                               int y0, int y1)
 {
-    // these lines below are just for compiling and can be deleted
-    (void)t;
-    (void)world_pos;
-    (void)material;
-    (void)lights;
-    (void)camera;
-    // these lines above are just for compiling and can be deleted
+    rasterize_in_range(t, world_pos, uniforms, x0, x1, y0, y1);
 }
+
+// 显式实例化渲染器使用的 shader 组合中定义在本文件内的成员函数
+template void Rasterizer<VertexShader, PhongFragmentShader>::draw_mt(
+    const VertexBuffer& vertices, const std::vector<unsigned int>& faces,
+    const GL::Material& material, const std::list<Light>& lights, const Camera& camera);
+template void Rasterizer<VertexShader, PhongFragmentShader>::rasterize_triangle_mt(
+    const Triangle& t, const std::array<Vector3f, 3>& world_pos, const UniformBlock& uniforms,
+    int x0, int x1, int y0, int y1);
+template void Rasterizer<VertexShader, GBufferShader>::draw_mt(
+    const VertexBuffer& vertices, const std::vector<unsigned int>& faces,
+    const GL::Material& material, const std::list<Light>& lights, const Camera& camera);
+template void Rasterizer<VertexShader, GBufferShader>::rasterize_triangle_mt(
+    const Triangle& t, const std::array<Vector3f, 3>& world_pos, const UniformBlock& uniforms,
+    int x0, int x1, int y0, int y1);
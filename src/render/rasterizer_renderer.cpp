@@ -1,5 +1,4 @@
 #include <algorithm>
-#include <fstream>
 #include <memory>
 #include <vector>
 #include <chrono>
@@ -22,39 +21,82 @@ using Eigen::Vector4f;
 
 // 光栅化渲染器的构造函数
 RasterizerRenderer::RasterizerRenderer(RenderEngine& engine)
-    : width(engine.width), height(engine.height), n_threads(engine.n_threads),
-      rendering_res(engine.rendering_res)
+    : width(engine.width), height(engine.height), n_threads(engine.n_threads), early_z(true),
+      backface_culling(false), rendering_res(engine.rendering_res),
+      image_writer(engine.image_writer), n_reused_vertex_buffers(0)
 {
     logger = get_logger("Rasterizer Renderer");
 }
 
+// 查找物体缓存的顶点缓冲，变换矩阵、成像平面尺寸和 mesh 都没有变化时可以直接复用
+bool RasterizerRenderer::find_vertex_buffer(const Object& object, const Eigen::Matrix4f& MVP,
+                                            const Eigen::Matrix4f& model, int width, int height,
+                                            VertexBuffer*& buffer)
+{
+    auto [iter, inserted]     = vertex_buffers.try_emplace(object.id);
+    CachedVertexBuffer& cache = iter->second;
+    buffer                    = &cache.buffer;
+    cache.used                = true;
+    if (!inserted && cache.MVP == MVP && cache.model == model && cache.width == width &&
+        cache.height == height && cache.mesh_version == object.mesh_version) {
+        ++n_reused_vertex_buffers;
+        return true;
+    }
+    cache.MVP          = MVP;
+    cache.model        = model;
+    cache.width        = width;
+    cache.height       = height;
+    cache.mesh_version = object.mesh_version;
+    return false;
+}
+
+// 释放已经被删除或本次没有被绘制的物体的顶点缓冲
+void RasterizerRenderer::release_unused_vertex_buffers()
+{
+    size_t n_used = 0;
+    for (auto iter = vertex_buffers.begin(); iter != vertex_buffers.end();) {
+        if (!iter->second.used) {
+            iter = vertex_buffers.erase(iter);
+            continue;
+        }
+        iter->second.used = false;
+        ++n_used;
+        ++iter;
+    }
+    this->logger->info("reused {} of {} post-transform vertex buffers", n_reused_vertex_buffers,
+                       n_used);
+    n_reused_vertex_buffers = 0;
+}
+
 // 光栅化渲染器的渲染调用接口
 void RasterizerRenderer::render(const Scene& scene)
 {
-    // initialize rasterizer
-    Rasterizer r(static_cast<int>(width), static_cast<int>(height));
-
-    // choose the active shader for fragment shader
-    std::function<Vector3f(FragmentShaderPayload, GL::Material, std::list<Light>, Camera)>
-        active_shader = phong_fragment_shader;
-    // set vertex shader
-    r.vertex_shader = vertex_shader;
-    // set fragment shader
-    r.fragment_shader = active_shader;
+    // initialize rasterizer, the active shaders are chosen by its template arguments
+    Rasterizer<VertexShader, PhongFragmentShader> r(static_cast<int>(width),
+                                                    static_cast<int>(height));
+    r.early_z          = early_z;
+    r.backface_culling = backface_culling;
 
-    // clear Color Buffer & Depth Buffer & rendering_res
+    // clear Color Buffer & Depth Buffer
     r.clear(BufferType::Color | BufferType::Depth);
-    this->rendering_res.clear();
     // run time statistics
     time_point begin_time = steady_clock::now();
+    // objects culled by their bounding boxes
+    size_t n_culled_objects = 0;
     for (const auto& group : scene.groups) {
 
         Camera cam = scene.camera;
         // set r.view & r.projection
         r.view       = cam.view();
         r.projection = cam.projection();
+        const Eigen::Matrix4f view_projection = r.projection * r.view;
 
         for (const auto& object : group->objects) {
+            // skip objects whose bounding boxes are entirely out of the view frustum
+            if (!object->in_frustum(view_projection)) {
+                ++n_culled_objects;
+                continue;
+            }
             // set r.model
             r.model = object->model();
             // set Uniforms for vertex shader
@@ -62,26 +104,14 @@ void RasterizerRenderer::render(const Scene& scene)
             Uniforms::inv_trans_M = r.model.inverse().transpose();
             Uniforms::width       = r.width;
             Uniforms::height      = r.height;
-            // input object->mesh's vertices & faces & normals data
-            std::vector<Triangle> TriangleList;
-            const std::vector<float>& vertices     = object->mesh.vertices.data;
-            const std::vector<unsigned int>& faces = object->mesh.faces.data;
-            const std::vector<float>& normals      = object->mesh.normals.data;
-
-            for (unsigned int i = 0; i < faces.size(); i += 3) {
-                // set triangle list(vertex & normal)
-                TriangleList.emplace_back();
-                Triangle& t = *TriangleList.rbegin();
-                for (int j = 0; j < 3; j++) {
-                    unsigned int idx = faces[i + j];
-                    t.vertex[j]      = Vector4f(vertices[3 * idx], vertices[3 * idx + 1],
-                                                vertices[3 * idx + 2], 1.0f);
-                    t.normal[j] =
-                        Vector3f(normals[3 * idx], normals[3 * idx + 1], normals[3 * idx + 2]);
-                }
+            // shade object->mesh's vertices unless they are cached from the last frame
+            VertexBuffer* vertices = nullptr;
+            if (!find_vertex_buffer(*object, Uniforms::MVP, r.model, r.width, r.height,
+                                    vertices)) {
+                r.shade_vertices(object->mesh, *vertices);
             }
             // call r.draw()
-            r.draw(TriangleList, object->mesh.material, scene.lights, cam);
+            r.draw(*vertices, object->mesh.faces.data, object->mesh.material, scene.lights, cam);
         }
     }
     time_point end_time         = steady_clock::now();
@@ -89,20 +119,13 @@ void RasterizerRenderer::render(const Scene& scene)
 
     this->logger->info("rendering (single thread) takes {:.6f} seconds",
                        rendering_duration.count());
+    this->logger->info("culled {} objects and triangles: {} near/far, {} frustum, {} backface, "
+                       "{} zero coverage ({} clipped by the near plane)",
+                       n_culled_objects, r.cull_stats.near_far, r.cull_stats.frustum,
+                       r.cull_stats.backface, r.cull_stats.zero_coverage, r.cull_stats.clipped);
+    release_unused_vertex_buffers();
 
-    // OutImage can be saved at the working directory as .ppm
-    std::ofstream output_image;
-    output_image.open("rasterizer_res.ppm");
-    int nx = static_cast<int>(width);
-    int ny = static_cast<int>(height);
-    output_image << "P3\n" << nx << ' ' << ny << "\n255\n";
-
-    for (long unsigned int i = 0; i < r.depth_buf.size(); i++) {
-        rendering_res.push_back(static_cast<unsigned char>(r.frame_buf[i].x()));
-        rendering_res.push_back(static_cast<unsigned char>(r.frame_buf[i].y()));
-        rendering_res.push_back(static_cast<unsigned char>(r.frame_buf[i].z()));
-
-        output_image << int(r.frame_buf[i].x()) << ' ' << int(r.frame_buf[i].y()) << ' '
-                     << int(r.frame_buf[i].z()) << '\n';
-    }
+    // convert the frame buffer for previewing, and save it in the background
+    ImageWriter::to_bytes(r.frame_buf, 255.0f, rendering_res);
+    image_writer.write("rasterizer_res", r.width, r.height, rendering_res, r.frame_buf, 255.0f);
 }
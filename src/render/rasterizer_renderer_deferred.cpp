@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <chrono>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <spdlog/spdlog.h>
+
+#include "rasterizer.h"
+#include "render_engine.h"
+#include "shader.h"
+#include "triangle.h"
+#include "../scene/light.h"
+
+using std::chrono::steady_clock;
+using duration   = std::chrono::duration<float>;
+using time_point = std::chrono::time_point<steady_clock, duration>;
+using Eigen::Vector3f;
+using Eigen::Vector4f;
+
+void RasterizerRenderer::render_deferred(const Scene& scene)
+{
+    // the geometry pass writes the G-buffer instead of shading fragments
+    Rasterizer<VertexShader, GBufferShader> r(static_cast<int>(width), static_cast<int>(height));
+
+    // clear Color Buffer (and G-buffer) & Depth Buffer
+    r.clear(BufferType::Color | BufferType::Depth);
+
+    time_point begin_time = steady_clock::now();
+    r.n_threads        = n_threads;
+    r.early_z          = early_z;
+    r.backface_culling = backface_culling;
+    // materials referred by material IDs in the G-buffer
+    std::vector<GL::Material> materials;
+    // objects culled by their bounding boxes
+    size_t n_culled_objects = 0;
+    for (const auto& group : scene.groups) {
+
+        Camera cam = scene.camera;
+        // set r.view & r.projection
+        r.view       = cam.view();
+        r.projection = cam.projection();
+        const Eigen::Matrix4f view_projection = r.projection * r.view;
+
+        for (const auto& object : group->objects) {
+            // skip objects whose bounding boxes are entirely out of the view frustum
+            if (!object->in_frustum(view_projection)) {
+                ++n_culled_objects;
+                continue;
+            }
+            // set r.model & r.material_id
+            r.model       = object->model();
+            r.material_id = static_cast<int>(materials.size());
+            materials.push_back(object->mesh.material);
+            // set Uniforms for vertex shader
+            Uniforms::MVP         = r.projection * r.view * r.model;
+            Uniforms::inv_trans_M = r.model.inverse().transpose();
+            Uniforms::width       = r.width;
+            Uniforms::height      = r.height;
+            // shade object->mesh's vertices unless they are cached from the last frame
+            VertexBuffer* vertices = nullptr;
+            if (!find_vertex_buffer(*object, Uniforms::MVP, r.model, r.width, r.height,
+                                    vertices)) {
+                r.shade_vertices(object->mesh, *vertices);
+            }
+            // call r.draw_mt()
+            r.draw_mt(*vertices, object->mesh.faces.data, object->mesh.material, scene.lights, cam);
+        }
+    }
+    time_point geometry_time = steady_clock::now();
+
+    // Lighting pass. Only the visible fragment of each pixel is shaded, and every row is an
+    // independent task of the thread pool.
+    std::vector<UniformBlock> uniforms;
+    uniforms.reserve(materials.size());
+    for (size_t i = 0; i < materials.size(); ++i) {
+        uniforms.emplace_back(materials[i], scene.lights, scene.camera, static_cast<int>(i));
+    }
+    const PhongFragmentShader fragment_shader;
+    RenderEngine::thread_pool().parallel_for(static_cast<size_t>(r.height), [&](size_t row) {
+        const size_t begin = row * static_cast<size_t>(r.width);
+        const size_t end   = begin + static_cast<size_t>(r.width);
+        for (size_t i = begin; i < end; ++i) {
+            const GBufferTexel& texel = r.g_buffer[i];
+            if (texel.material_id < 0) {
+                continue;
+            }
+            const FragmentShaderPayload payload(texel.world_pos, texel.world_normal);
+            r.frame_buf[i] = fragment_shader(payload, uniforms[texel.material_id]);
+        }
+    });
+    time_point end_time = steady_clock::now();
+
+    this->logger->info("rendering (deferred, {} threads) takes {:.6f} seconds "
+                       "(geometry {:.6f}, lighting {:.6f})",
+                       n_threads, duration(end_time - begin_time).count(),
+                       duration(geometry_time - begin_time).count(),
+                       duration(end_time - geometry_time).count());
+    this->logger->info("culled {} objects and triangles: {} near/far, {} frustum, {} backface, "
+                       "{} zero coverage ({} clipped by the near plane)",
+                       n_culled_objects, r.cull_stats.near_far, r.cull_stats.frustum,
+                       r.cull_stats.backface, r.cull_stats.zero_coverage, r.cull_stats.clipped);
+    release_unused_vertex_buffers();
+
+    // convert the frame buffer for previewing, and save it in the background
+    ImageWriter::to_bytes(r.frame_buf, 255.0f, rendering_res);
+    image_writer.write("rasterizer_res", r.width, r.height, rendering_res, r.frame_buf, 255.0f);
+}
@@ -1,6 +1,5 @@
 #include <algorithm>
 #include <cmath>
-#include <fstream>
 #include <memory>
 #include <vector>
 #include <chrono>
@@ -25,51 +24,63 @@ using Eigen::Vector4f;
 
 void RasterizerRenderer::render_mt(const Scene& scene)
 {
-    Rasterizer r(static_cast<int>(width), static_cast<int>(height));
+    // the active shaders are chosen by template arguments of the rasterizer
+    Rasterizer<VertexShader, PhongFragmentShader> r(static_cast<int>(width),
+                                                    static_cast<int>(height));
 
-    // choose the active shader for fragment shader
-    std::function<Vector3f(FragmentShaderPayload, GL::Material, const std::list<Light>&, Camera)>
-        active_shader = phong_fragment_shader;
-
-    r.vertex_shader   = vertex_shader;
-    r.fragment_shader = active_shader;
-
-    // clear Color Buffer & Depth Buffer & rendering_res
+    // clear Color Buffer & Depth Buffer
     r.clear(BufferType::Color | BufferType::Depth);
-    this->rendering_res.clear();
 
     time_point begin_time = steady_clock::now();
-
-
-
-    
-    // this line below is just for compiling and can be deleted
-    (void)scene;
-    
-    // multi-thread render_mt should be completed here
-
-    
-    
-    
+    // tile workers of the rasterizer are driven by RenderEngine::n_threads
+    r.n_threads        = n_threads;
+    r.early_z          = early_z;
+    r.backface_culling = backface_culling;
+    // objects culled by their bounding boxes
+    size_t n_culled_objects = 0;
+    for (const auto& group : scene.groups) {
+
+        Camera cam = scene.camera;
+        // set r.view & r.projection
+        r.view       = cam.view();
+        r.projection = cam.projection();
+        const Eigen::Matrix4f view_projection = r.projection * r.view;
+
+        for (const auto& object : group->objects) {
+            // skip objects whose bounding boxes are entirely out of the view frustum
+            if (!object->in_frustum(view_projection)) {
+                ++n_culled_objects;
+                continue;
+            }
+            // set r.model
+            r.model = object->model();
+            // set Uniforms for vertex shader
+            Uniforms::MVP         = r.projection * r.view * r.model;
+            Uniforms::inv_trans_M = r.model.inverse().transpose();
+            Uniforms::width       = r.width;
+            Uniforms::height      = r.height;
+            // shade object->mesh's vertices unless they are cached from the last frame
+            VertexBuffer* vertices = nullptr;
+            if (!find_vertex_buffer(*object, Uniforms::MVP, r.model, r.width, r.height,
+                                    vertices)) {
+                r.shade_vertices(object->mesh, *vertices);
+            }
+            // call r.draw_mt()
+            r.draw_mt(*vertices, object->mesh.faces.data, object->mesh.material, scene.lights, cam);
+        }
+    }
     time_point end_time         = steady_clock::now();
     duration rendering_duration = end_time - begin_time;
 
     this->logger->info("rendering ({} threads) takes {:.6f} seconds", n_threads,
                        rendering_duration.count());
-
-    // OutImage can be saved at the working directory as .ppm
-    std::ofstream output_image;
-    output_image.open("rasterizer_res.ppm");
-    int nx = static_cast<int>(width);
-    int ny = static_cast<int>(height);
-    output_image << "P3\n" << nx << ' ' << ny << "\n255\n";
-
-    for (long unsigned int i = 0; i < r.depth_buf.size(); i++) {
-        rendering_res.push_back(static_cast<unsigned char>(r.frame_buf[i].x()));
-        rendering_res.push_back(static_cast<unsigned char>(r.frame_buf[i].y()));
-        rendering_res.push_back(static_cast<unsigned char>(r.frame_buf[i].z()));
-
-        output_image << int(r.frame_buf[i].x()) << ' ' << int(r.frame_buf[i].y()) << ' '
-                     << int(r.frame_buf[i].z()) << '\n';
-    }
+    this->logger->info("culled {} objects and triangles: {} near/far, {} frustum, {} backface, "
+                       "{} zero coverage ({} clipped by the near plane)",
+                       n_culled_objects, r.cull_stats.near_far, r.cull_stats.frustum,
+                       r.cull_stats.backface, r.cull_stats.zero_coverage, r.cull_stats.clipped);
+    release_unused_vertex_buffers();
+
+    // convert the frame buffer for previewing, and save it in the background
+    ImageWriter::to_bytes(r.frame_buf, 255.0f, rendering_res);
+    image_writer.write("rasterizer_res", r.width, r.height, rendering_res, r.frame_buf, 255.0f);
 }
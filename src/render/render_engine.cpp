@@ -1,5 +1,8 @@
 #include "render_engine.h"
 
+#include <algorithm>
+#include <thread>
+
 Eigen::Vector3f RenderEngine::background_color(RGB(100, 100, 100));
 
 RenderEngine::RenderEngine()
@@ -12,12 +15,21 @@ RenderEngine::RenderEngine()
     n_threads = 4;
 }
 
+ThreadPool& RenderEngine::thread_pool()
+{
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
 // choose render type
 void RenderEngine::render(Scene& scene, RendererType type)
 {
+    n_threads = std::max(1, n_threads);
+    thread_pool().resize(static_cast<size_t>(n_threads));
     switch (type) {
     case RendererType::RASTERIZER: rasterizer_render->render(scene); break;
     case RendererType::RASTERIZER_MT: rasterizer_render->render_mt(scene); break;
+    case RendererType::RASTERIZER_DEFERRED: rasterizer_render->render_deferred(scene); break;
     case RendererType::WHITTED_STYLE: whitted_render->render(scene); break;
     default: break;
     }
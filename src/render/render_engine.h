@@ -3,12 +3,16 @@
 
 #include <memory>
 #include <functional>
+#include <unordered_map>
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <spdlog/spdlog.h>
 
 #include "../scene/scene.h"
+#include "../utils/thread_pool.h"
+#include "rasterizer.h"
+#include "image_writer.h"
 
 /*!
  * \file render/render_engine.h
@@ -21,6 +25,7 @@ enum class RendererType
 {
     RASTERIZER,
     RASTERIZER_MT,
+    RASTERIZER_DEFERRED,
     WHITTED_STYLE
 };
 
@@ -38,8 +43,10 @@ public:
     std::vector<unsigned char> rendering_res;
     /*! \~chinese 根据aspect_ratio对渲染出图片的长和宽进行设置*/
     float width, height;
-    /*! \~chinese 使用多线程时的线程数设置*/
+    /*! \~chinese 使用多线程时的线程数设置，每次渲染前线程池都会被调整到这个大小*/
     int n_threads;
+    /*! \~chinese 在后台线程中保存渲染结果，所有渲染器共用*/
+    ImageWriter image_writer;
     /*!
      * \~chinese
      * \brief 渲染器的渲染函数
@@ -53,6 +60,15 @@ public:
     void render(Scene& scene, RendererType type);
     /*! \~chinese 渲染结果预览的背景颜色*/
     static Eigen::Vector3f background_color;
+    /*!
+     * \~chinese
+     * \brief 渲染器和 BVH 构建共用的常驻线程池
+     *
+     * 线程池在第一次访问时创建，初始线程数为硬件线程数；之后每次调用 `render`
+     * 时会被调整为 `n_threads` 个线程。多线程光栅化、Whitted-style 光线追踪和
+     * BVH 构建都向它提交任务，而不是每次调用都创建新的线程。
+     */
+    static ThreadPool& thread_pool();
 
     /*! \~chinese 光栅化渲染器*/
     std::unique_ptr<RasterizerRenderer> rasterizer_render;
@@ -73,12 +89,62 @@ public:
     void render(const Scene& scene);
     /*! \~chinese 多线程光栅化渲染器的渲染调用接口*/
     void render_mt(const Scene& scene);
+    /*!
+     * \~chinese
+     * \brief 延迟着色光栅化渲染器的渲染调用接口
+     *
+     * 几何阶段（多线程）只把每个像素最终可见片元的位置、法线和材质编号写入 G-buffer ，
+     * 光照阶段再对 G-buffer 的每个像素并行地计算一次 Blinn-Phong 光照。被遮挡的片元
+     * 不会参与光照计算，着色开销只与像素数和光源数有关。
+     */
+    void render_deferred(const Scene& scene);
     float& width;
     float& height;
     int& n_threads;
+    /*! \~chinese 是否在执行 fragment shader 之前做深度测试*/
+    bool early_z;
+    /*! \~chinese 是否剔除背面朝向相机的三角形*/
+    bool backface_culling;
     std::vector<unsigned char>& rendering_res;
+    ImageWriter& image_writer;
 
 private:
+    /*!
+     * \~chinese
+     * \brief 跨帧保存的顶点缓冲，以及生成它时的变换矩阵、成像平面尺寸和 mesh 版本
+     */
+    struct CachedVertexBuffer
+    {
+        Eigen::Matrix4f MVP;
+        Eigen::Matrix4f model;
+        int width;
+        int height;
+        std::size_t mesh_version;
+        /*! \~chinese 本次渲染是否用到了这个缓冲，没有用到的缓冲在渲染结束时被释放 */
+        bool used;
+        VertexBuffer buffer;
+    };
+    /*!
+     * \~chinese
+     * \brief 查找物体的顶点缓冲
+     *
+     * \param object 要绘制的物体
+     * \param MVP 物体当前的 MVP 矩阵
+     * \param model 物体当前的模型变换矩阵
+     * \param width 成像平面的宽度
+     * \param height 成像平面的高度
+     * \param buffer 输出物体对应的顶点缓冲
+     * \return 缓冲中的数据是否可以直接使用；返回 false 时调用者需要重新对顶点应用 vertex shader
+     */
+    bool find_vertex_buffer(const Object& object, const Eigen::Matrix4f& MVP,
+                            const Eigen::Matrix4f& model, int width, int height,
+                            VertexBuffer*& buffer);
+    /*! \~chinese 释放本次渲染没有用到的顶点缓冲，并输出复用情况 */
+    void release_unused_vertex_buffers();
+    /*! \~chinese 以物体 ID 为键的顶点缓冲 (post-transform cache) */
+    std::unordered_map<std::size_t, CachedVertexBuffer> vertex_buffers;
+    /*! \~chinese 本次渲染中直接复用的顶点缓冲数量 */
+    std::size_t n_reused_vertex_buffers;
     std::shared_ptr<spdlog::logger> logger;
 };
 
@@ -95,12 +161,15 @@ public:
     void render(Scene& scene);
     /*! \~chinese 镜面反射的阈值为material.shiness>=1000*/
     static constexpr float mirror_threshold = 1000.0f;
+    /*! \~chinese 动态分配给各个线程的屏幕分块的边长（像素）*/
+    static constexpr int tile_size = 16;
     float& width;
     float& height;
     int& n_threads;
     /*! \~chinese 是否使用BVH进行加速*/
     bool use_bvh;
     std::vector<unsigned char>& rendering_res;
+    ImageWriter& image_writer;
 
 private:
     /*!
@@ -114,6 +183,31 @@ private:
      */
     float fresnel(const Eigen::Vector3f& I, const Eigen::Vector3f& N, const float& ior);
     std::optional<std::tuple<Intersection, GL::Material>> trace(const Ray& ray, const Scene& scene);
+    /*!
+     * \~chinese
+     * \brief 对一组方向相近的光线（如同一行像素的主光线）批量调用 `trace`
+     *
+     * 使用 BVH 时按 `RayPacket::size` 条光线一组遍历 TLAS 和各物体的 BVH ，结果与逐条调用
+     * `trace` 相同。
+     *
+     * \param rays 所有光线
+     * \param n 光线数
+     * \param scene 当前渲染的场景
+     * \param results 每条光线的求交结果
+     */
+    void trace_n(const Ray* rays, std::size_t n, const Scene& scene,
+                 std::optional<std::tuple<Intersection, GL::Material>>* results);
+    /*!
+     * \~chinese
+     * \brief 阴影测试：判断光线在到达 `t_max` 之前是否被场景中的物体遮挡
+     *
+     * 使用 BVH 时找到第一个遮挡物就返回，比调用 `trace` 求最近交点快得多。
+     *
+     * \param ray 从着色点射向光源的光线
+     * \param scene 当前渲染的场景
+     * \param t_max 着色点到光源的距离
+     */
+    bool occluded(const Ray& ray, const Scene& scene, float t_max);
     /*!
      * \~chinese
      * \brief 实现光线追踪
@@ -121,9 +215,12 @@ private:
      * \param ray 当前追踪的光线
      * \param scene 当前渲染的场景
      * \param depth 当前反射的次数
+     * \param hit 已经求得的 `trace(ray, scene)` 的结果，为空时由这个函数自己调用 `trace`
      *
      */
-    Eigen::Vector3f cast_ray(const Ray& ray, const Scene& scene, int depth);
+    Eigen::Vector3f
+    cast_ray(const Ray& ray, const Scene& scene, int depth,
+             const std::optional<std::tuple<Intersection, GL::Material>>* hit = nullptr);
     std::shared_ptr<spdlog::logger> logger;
 };
 
@@ -16,57 +16,20 @@ Eigen::Matrix4f Uniforms::inv_trans_M;
 int Uniforms::width;
 int Uniforms::height;
 
+UniformBlock::UniformBlock(const GL::Material& material, const std::list<Light>& lights,
+                           const Camera& camera, int material_id)
+    : material(material), material_id(material_id), lights(lights.begin(), lights.end()),
+      camera_position(camera.position)
+{
+}
+
 // vertex shader
 VertexShaderPayload vertex_shader(const VertexShaderPayload& payload)
 {
-    VertexShaderPayload output_payload = payload;
-
-    
-
-    // Vertex position transformation
-    
-
-    // Viewport transformation
-    
-
-    // Vertex normal transformation
-    
-
-    return output_payload;
+    return VertexShader()(payload);
 }
 
-Vector3f phong_fragment_shader(const FragmentShaderPayload& payload, GL::Material material,
-                               const std::list<Light>& lights, Camera camera)
+Vector3f phong_fragment_shader(const FragmentShaderPayload& payload, const UniformBlock& uniforms)
 {
-    // these lines below are just for compiling and can be deleted
-    (void)payload;
-    (void)material;
-    (void)lights;
-    (void)camera;
-    // these lines above are just for compiling and can be deleted
-    
-    Vector3f result = {0, 0, 0};
-    
-    // ka,kd,ks can be got from material.ambient,material.diffuse,material.specular
-    
-
-    // set ambient light intensity
-
-    // Light Direction
-        
-    // View Direction
-        
-    // Half Vector
-        
-    // Light Attenuation
-        
-    // Ambient
-        
-    // Diffuse
-        
-    // Specular
-        
-    // set rendering result max threshold to 255
-    
-    return result * 255.f;
+    return PhongFragmentShader()(payload, uniforms);
 }
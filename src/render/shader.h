@@ -1,6 +1,8 @@
 #ifndef DANDELION_RENDER_SHADER_PAYLOAD_H
 #define DANDELION_RENDER_SHADER_PAYLOAD_H
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include <list>
 
@@ -37,6 +39,28 @@ struct Uniforms
     ///@}
 };
 
+/*!
+ * \~chinese
+ * \brief 每次绘制（`Rasterizer::draw`）时绑定一次的 fragment shader 参数块
+ *
+ * 材质、光源和相机位置对同一个物体的所有片元都相同，因此在绘制开始时复制一次，
+ * 之后以常引用传给每个片元，避免了逐片元复制 `GL::Material` 、`Camera` 和整个光源链表。
+ * 光源被复制到连续存储的 `std::vector` 中以便遍历。
+ */
+struct UniformBlock
+{
+    UniformBlock(const GL::Material& material, const std::list<Light>& lights,
+                 const Camera& camera, int material_id = 0);
+    /*! \~chinese 当前渲染物体的材质 */
+    GL::Material material;
+    /*! \~chinese 当前渲染物体的材质编号，延迟着色时写入 G-buffer */
+    int material_id;
+    /*! \~chinese 场景中的所有光源 */
+    std::vector<Light> lights;
+    /*! \~chinese 相机（观察点）在世界坐标系下的位置 */
+    Eigen::Vector3f camera_position;
+};
+
 /*!
  * \~chinese
  * \brief 作用于每个屏幕上的片元，通常是计算颜色。
@@ -72,25 +96,147 @@ struct VertexShaderPayload
  * 首先是将顶点坐标变换到投影平面，再进行视口变换；
  * 其次是将法线向量变换到世界坐标系
  *
- * \param payload 输入时顶点和法线均为模型坐标系
- * 输出时顶点经过视口变换变换到了屏幕空间，法线向量则为世界坐标系
+ * 作为 `Rasterizer` 的模板参数使用，调用可以被编译器内联。
  */
-VertexShaderPayload vertex_shader(const VertexShaderPayload& payload);
+struct VertexShader
+{
+    /*!
+     * \~chinese
+     * \param payload 输入时顶点和法线均为模型坐标系
+     * 输出时顶点经过视口变换变换到了屏幕空间，法线向量则为世界坐标系
+     */
+    VertexShaderPayload operator()(const VertexShaderPayload& payload) const;
+};
 
 /*!
  * \~chinese
- * \brief 计算每个片元（像素）的颜色
+ * \brief 使用 Blinn-Phong 模型计算每个片元（像素）的颜色
  *
  * 根据输入参数：计算好的片元的位置和法线方向；材质(ka,kd,ks);场景光源以及视角
- * 计算当前片元的颜色
+ * 计算当前片元的颜色。作为 `Rasterizer` 的模板参数使用，调用可以被编译器内联。
+ */
+struct PhongFragmentShader
+{
+    /*!
+     * \~chinese
+     * \param payload 装的是世界坐标系下的片元位置以及法向量
+     * \param uniforms 当前绘制绑定的材质、光源和相机位置
+     */
+    Eigen::Vector3f operator()(const FragmentShaderPayload& payload,
+                               const UniformBlock& uniforms) const;
+};
+
+/*!
+ * \~chinese
+ * \brief G-buffer 中每个像素存储的几何信息
+ */
+struct GBufferTexel
+{
+    /*! \~chinese 世界坐标系下的位置 */
+    Eigen::Vector3f world_pos;
+    /*! \~chinese 世界坐标系下的法向量 */
+    Eigen::Vector3f world_normal;
+    /*! \~chinese 材质编号，-1 表示该像素没有被任何片元覆盖 */
+    int material_id;
+};
+
+/*!
+ * \~chinese
+ * \brief 延迟着色的几何阶段使用的 fragment shader ，只记录片元的几何信息而不计算光照
  *
- * \param payload 装的是相机坐标系下的片元位置以及法向量
- * \param material 当前片元所在物体的材质，包括ka,kd,ks
- * \param lights 当前场景中的所有光源
- * \param camera 当前观察相机
+ * 作为 `Rasterizer` 的模板参数使用时，光栅化器将输出写入 G-buffer 而不是 frame buffer 。
+ */
+struct GBufferShader
+{
+    /*!
+     * \~chinese
+     * \param payload 装的是世界坐标系下的片元位置以及法向量
+     * \param uniforms 当前绘制绑定的材质编号
+     */
+    GBufferTexel operator()(const FragmentShaderPayload& payload,
+                            const UniformBlock& uniforms) const;
+};
+
+/*!
+ * \~chinese
+ * \brief 计算顶点的各项属性几何变化，与 `VertexShader` 相同
+ *
+ * \param payload 输入时顶点和法线均为模型坐标系
+ * 输出时顶点经过视口变换变换到了屏幕空间，法线向量则为世界坐标系
+ */
+VertexShaderPayload vertex_shader(const VertexShaderPayload& payload);
+
+/*!
+ * \~chinese
+ * \brief 计算每个片元（像素）的颜色，与 `PhongFragmentShader` 相同
  *
+ * \param payload 装的是世界坐标系下的片元位置以及法向量
+ * \param uniforms 当前绘制绑定的材质、光源和相机位置
  */
-Eigen::Vector3f phong_fragment_shader(const FragmentShaderPayload& payload, GL::Material material,
-                                      const std::list<Light>& lights, Camera camera);
+Eigen::Vector3f phong_fragment_shader(const FragmentShaderPayload& payload,
+                                      const UniformBlock& uniforms);
+
+inline VertexShaderPayload VertexShader::operator()(const VertexShaderPayload& payload) const
+{
+    VertexShaderPayload output_payload = payload;
+
+    // Vertex position transformation
+    const Eigen::Vector4f clip_pos = Uniforms::MVP * payload.position;
+    // Keep w of the clip space position for perspective-correct interpolation
+    const float w             = clip_pos.w();
+    const Eigen::Vector3f ndc = clip_pos.head<3>() / w;
+
+    // Viewport transformation
+    output_payload.position.x() = 0.5f * (ndc.x() + 1.0f) * static_cast<float>(Uniforms::width);
+    output_payload.position.y() = 0.5f * (ndc.y() + 1.0f) * static_cast<float>(Uniforms::height);
+    output_payload.position.z() = ndc.z();
+    output_payload.position.w() = w;
+
+    // Vertex normal transformation
+    const Eigen::Vector4f normal(payload.normal.x(), payload.normal.y(), payload.normal.z(), 0.0f);
+    output_payload.normal = (Uniforms::inv_trans_M * normal).head<3>().normalized();
+
+    return output_payload;
+}
+
+inline Eigen::Vector3f PhongFragmentShader::operator()(const FragmentShaderPayload& payload,
+                                                       const UniformBlock& uniforms) const
+{
+    // ka,kd,ks can be got from material.ambient,material.diffuse,material.specular
+    const GL::Material& material  = uniforms.material;
+    const Eigen::Vector3f& normal = payload.world_normal;
+
+    // set ambient light intensity
+    const Eigen::Vector3f ambient_intensity(0.1f, 0.1f, 0.1f);
+    // View Direction
+    const Eigen::Vector3f view_dir = (uniforms.camera_position - payload.world_pos).normalized();
+
+    // Ambient
+    Eigen::Vector3f result = material.ambient.cwiseProduct(ambient_intensity);
+    for (const Light& light : uniforms.lights) {
+        // Light Direction
+        const Eigen::Vector3f to_light  = light.position - payload.world_pos;
+        const float r2                  = to_light.squaredNorm();
+        const Eigen::Vector3f light_dir = to_light / std::sqrt(r2);
+        // Half Vector
+        const Eigen::Vector3f half_vector = (light_dir + view_dir).normalized();
+        // Light Attenuation
+        const float attenuated = light.intensity / r2;
+        // Diffuse
+        result += material.diffuse * (attenuated * (std::max)(0.0f, normal.dot(light_dir)));
+        // Specular
+        result += material.specular *
+                  (attenuated *
+                   std::pow((std::max)(0.0f, normal.dot(half_vector)), material.shininess));
+    }
+    // set rendering result max threshold to 255
+    return result.cwiseMin(1.0f) * 255.f;
+}
+
+inline GBufferTexel GBufferShader::operator()(const FragmentShaderPayload& payload,
+                                             const UniformBlock& uniforms) const
+{
+    return {payload.world_pos, payload.world_normal, uniforms.material_id};
+}
 
 #endif // DANDELION_RENDER_SHADER_PAYLOAD_H
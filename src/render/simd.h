@@ -0,0 +1,200 @@
+#ifndef DANDELION_RENDER_SIMD_H
+#define DANDELION_RENDER_SIMD_H
+
+/*!
+ * \file render/simd.h
+ * \ingroup rendering
+ * \~chinese
+ * \brief 软光栅化器和宽 BVH 使用的 SIMD 浮点向量封装。
+ *
+ * 使用的指令集由 CMake 选项 `DANDELION_RASTERIZER_SIMD` 决定：定义了 `DANDELION_SIMD_AVX2`
+ * 时每个向量有 8 个通道，定义了 `DANDELION_SIMD_SSE` 时有 4 个通道，两者都没有定义时退化为
+ * 只有 1 个通道的标量实现。光栅化代码和帧缓冲的格式转换只通过 `FloatLanes` 的接口访问向量，
+ * 因此三种实现可以无缝切换。
+ */
+
+#include <cstring>
+
+#if defined(DANDELION_SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(DANDELION_SIMD_SSE)
+#include <emmintrin.h>
+#endif
+
+/*!
+ * \ingroup rendering
+ * \~chinese
+ * \brief 一组并行计算的 float ，光栅化时每个通道对应同一行上相邻的一个像素。
+ */
+struct FloatLanes
+{
+#if defined(DANDELION_SIMD_AVX2)
+    /*! \~chinese 通道数 */
+    static constexpr int width = 8;
+    __m256 v;
+
+    static FloatLanes broadcast(float x)
+    {
+        return {_mm256_set1_ps(x)};
+    }
+    /*! \~chinese 从 `in` 开始读取 width 个 float ，不要求对齐 */
+    static FloatLanes load(const float* in)
+    {
+        return {_mm256_loadu_ps(in)};
+    }
+    /*! \~chinese 各通道的值依次为 \f$0, 1, \ldots, \mathrm{width}-1\f$ */
+    static FloatLanes ramp()
+    {
+        return {_mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f)};
+    }
+    friend FloatLanes operator+(FloatLanes a, FloatLanes b)
+    {
+        return {_mm256_add_ps(a.v, b.v)};
+    }
+    friend FloatLanes operator-(FloatLanes a, FloatLanes b)
+    {
+        return {_mm256_sub_ps(a.v, b.v)};
+    }
+    friend FloatLanes operator*(FloatLanes a, FloatLanes b)
+    {
+        return {_mm256_mul_ps(a.v, b.v)};
+    }
+    friend FloatLanes operator/(FloatLanes a, FloatLanes b)
+    {
+        return {_mm256_div_ps(a.v, b.v)};
+    }
+    friend FloatLanes min(FloatLanes a, FloatLanes b)
+    {
+        return {_mm256_min_ps(a.v, b.v)};
+    }
+    friend FloatLanes max(FloatLanes a, FloatLanes b)
+    {
+        return {_mm256_max_ps(a.v, b.v)};
+    }
+    /*! \~chinese 值不小于 0 的通道对应的二进制位为 1 */
+    int non_negative_mask() const
+    {
+        return _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ));
+    }
+    void store(float* out) const
+    {
+        _mm256_storeu_ps(out, v);
+    }
+    /*! \~chinese 截断为整数后按 8 位无符号整数写出，各通道的值须在 \f$[0, 255]\f$ 内 */
+    void store_bytes(unsigned char* out) const
+    {
+        const __m256i i32 = _mm256_cvttps_epi32(v);
+        const __m128i i16 = _mm_packs_epi32(_mm256_castsi256_si128(i32),
+                                            _mm256_extracti128_si256(i32, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(i16, i16));
+    }
+#elif defined(DANDELION_SIMD_SSE)
+    static constexpr int width = 4;
+    __m128 v;
+
+    static FloatLanes broadcast(float x)
+    {
+        return {_mm_set1_ps(x)};
+    }
+    static FloatLanes load(const float* in)
+    {
+        return {_mm_loadu_ps(in)};
+    }
+    static FloatLanes ramp()
+    {
+        return {_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f)};
+    }
+    friend FloatLanes operator+(FloatLanes a, FloatLanes b)
+    {
+        return {_mm_add_ps(a.v, b.v)};
+    }
+    friend FloatLanes operator-(FloatLanes a, FloatLanes b)
+    {
+        return {_mm_sub_ps(a.v, b.v)};
+    }
+    friend FloatLanes operator*(FloatLanes a, FloatLanes b)
+    {
+        return {_mm_mul_ps(a.v, b.v)};
+    }
+    friend FloatLanes operator/(FloatLanes a, FloatLanes b)
+    {
+        return {_mm_div_ps(a.v, b.v)};
+    }
+    friend FloatLanes min(FloatLanes a, FloatLanes b)
+    {
+        return {_mm_min_ps(a.v, b.v)};
+    }
+    friend FloatLanes max(FloatLanes a, FloatLanes b)
+    {
+        return {_mm_max_ps(a.v, b.v)};
+    }
+    int non_negative_mask() const
+    {
+        return _mm_movemask_ps(_mm_cmpge_ps(v, _mm_setzero_ps()));
+    }
+    void store(float* out) const
+    {
+        _mm_storeu_ps(out, v);
+    }
+    void store_bytes(unsigned char* out) const
+    {
+        const __m128i i16 = _mm_packs_epi32(_mm_cvttps_epi32(v), _mm_setzero_si128());
+        const int bytes   = _mm_cvtsi128_si32(_mm_packus_epi16(i16, i16));
+        std::memcpy(out, &bytes, 4);
+    }
+#else
+    static constexpr int width = 1;
+    float v;
+
+    static FloatLanes broadcast(float x)
+    {
+        return {x};
+    }
+    static FloatLanes load(const float* in)
+    {
+        return {*in};
+    }
+    static FloatLanes ramp()
+    {
+        return {0.0f};
+    }
+    friend FloatLanes operator+(FloatLanes a, FloatLanes b)
+    {
+        return {a.v + b.v};
+    }
+    friend FloatLanes operator-(FloatLanes a, FloatLanes b)
+    {
+        return {a.v - b.v};
+    }
+    friend FloatLanes operator*(FloatLanes a, FloatLanes b)
+    {
+        return {a.v * b.v};
+    }
+    friend FloatLanes operator/(FloatLanes a, FloatLanes b)
+    {
+        return {a.v / b.v};
+    }
+    friend FloatLanes min(FloatLanes a, FloatLanes b)
+    {
+        return {a.v < b.v ? a.v : b.v};
+    }
+    friend FloatLanes max(FloatLanes a, FloatLanes b)
+    {
+        return {a.v > b.v ? a.v : b.v};
+    }
+    int non_negative_mask() const
+    {
+        return v >= 0.0f ? 1 : 0;
+    }
+    void store(float* out) const
+    {
+        *out = v;
+    }
+    void store_bytes(unsigned char* out) const
+    {
+        *out = static_cast<unsigned char>(v);
+    }
+#endif
+};
+
+#endif // DANDELION_RENDER_SIMD_H
@@ -1,11 +1,15 @@
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <fstream>
 #include <memory>
 #include <vector>
 #include <optional>
 #include <iostream>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
@@ -54,7 +58,7 @@ void UpdateProgress(float progress)
 
 WhittedRenderer::WhittedRenderer(RenderEngine& engine)
     : width(engine.width), height(engine.height), n_threads(engine.n_threads), use_bvh(false),
-      rendering_res(engine.rendering_res)
+      rendering_res(engine.rendering_res), image_writer(engine.image_writer)
 {
     logger = get_logger("Whitted Renderer");
 }
@@ -65,6 +69,8 @@ void WhittedRenderer::render(Scene& scene)
     time_point begin_time = steady_clock::now();
     width                 = std::floor(width);
     height                = std::floor(height);
+    // refit (or rebuild after objects are added or removed) the scene-level BVH
+    scene.tlas.update(scene.groups);
 
     // initialize frame buffer
     std::vector<Vector3f> framebuffer(static_cast<size_t>(width * height));
@@ -72,31 +78,69 @@ void WhittedRenderer::render(Scene& scene)
         v = Vector3f(0.0f, 0.0f, 0.0f);
     }
 
-    int idx = 0;
-    for (int j = 0; j < height; j++) {
-        for (int i = 0; i < width; i++) {
-            // generate ray
-            Ray ray = generate_ray(static_cast<int>(width), static_cast<int>(height), i, j,
-                                   scene.camera, 1.0f);
-            // cast ray
-            framebuffer[idx++] = cast_ray(ray, scene, 0);
+    // The image is split into tiles which are handed out to the workers through an atomic
+    // counter, so that workers finishing cheap tiles keep taking new ones while others are
+    // still busy with mirror-heavy regions. Workers only count finished tiles, and the
+    // progress bar is printed by this thread.
+    const int n_rows       = static_cast<int>(height);
+    const int n_cols       = static_cast<int>(width);
+    const int n_tiles_x    = (n_cols + tile_size - 1) / tile_size;
+    const int n_tiles_y    = (n_rows + tile_size - 1) / tile_size;
+    const int n_tiles      = n_tiles_x * n_tiles_y;
+    const size_t n_workers = static_cast<size_t>(std::max(1, n_threads));
+    std::atomic<int> next_tile(0);
+    std::atomic<int> tiles_done(0);
+    std::mutex finish_mutex;
+    std::condition_variable finished;
+    auto render_tiles = [&]() {
+        for (int tile = next_tile++; tile < n_tiles; tile = next_tile++) {
+            const int x0 = (tile % n_tiles_x) * tile_size;
+            const int y0 = (tile / n_tiles_x) * tile_size;
+            const int x1 = std::min(x0 + tile_size, n_cols);
+            const int y1 = std::min(y0 + tile_size, n_rows);
+            // primary rays of one tile row are coherent, so they are traced together
+            std::array<Ray, tile_size> rays;
+            std::array<std::optional<std::tuple<Intersection, GL::Material>>, tile_size> hits;
+            const size_t n_rays = static_cast<size_t>(x1 - x0);
+            for (int j = y0; j < y1; j++) {
+                for (int i = x0; i < x1; i++) {
+                    // generate ray
+                    rays[i - x0] = generate_ray(n_cols, n_rows, i, j, scene.camera, 1.0f);
+                }
+                trace_n(rays.data(), n_rays, scene, hits.data());
+                int idx = j * n_cols + x0;
+                for (size_t i = 0; i < n_rays; i++) {
+                    // cast ray
+                    framebuffer[idx++] = cast_ray(rays[i], scene, 0, &hits[i]);
+                }
+            }
+            if (tiles_done.fetch_add(1, std::memory_order_relaxed) + 1 == n_tiles) {
+                std::lock_guard<std::mutex> lock(finish_mutex);
+                finished.notify_one();
+            }
         }
-        UpdateProgress(j / height);
+    };
+    ThreadPool& pool = RenderEngine::thread_pool();
+    ThreadPool::TaskGroup workers;
+    for (size_t worker = 0; worker < n_workers; ++worker) {
+        pool.submit(workers, render_tiles);
     }
-    // save result to whitted_res.ppm
-    FILE* fp = fopen("whitted_res.ppm", "wb");
-    (void)fprintf(fp, "P6\n%d %d\n255\n", (int)width, (int)height);
-    static unsigned char color_res[3];
-    rendering_res.clear();
-    for (long unsigned int i = 0; i < framebuffer.size(); i++) {
-        color_res[0] = static_cast<unsigned char>(255 * clamp(0.f, 1.f, framebuffer[i][0]));
-        color_res[1] = static_cast<unsigned char>(255 * clamp(0.f, 1.f, framebuffer[i][1]));
-        color_res[2] = static_cast<unsigned char>(255 * clamp(0.f, 1.f, framebuffer[i][2]));
-        fwrite(color_res, 1, 3, fp);
-        rendering_res.push_back(color_res[0]);
-        rendering_res.push_back(color_res[1]);
-        rendering_res.push_back(color_res[2]);
+    {
+        std::unique_lock<std::mutex> lock(finish_mutex);
+        while (!finished.wait_for(lock, std::chrono::milliseconds(100), [&]() {
+            return tiles_done.load(std::memory_order_relaxed) == n_tiles;
+        })) {
+            UpdateProgress(static_cast<float>(tiles_done.load(std::memory_order_relaxed)) /
+                           static_cast<float>(n_tiles));
+        }
     }
+    pool.wait(workers);
+    UpdateProgress(1.0f);
+    std::cout << std::endl;
+    // convert the frame buffer for previewing, and save it in the background
+    ImageWriter::to_bytes(framebuffer, 1.0f, rendering_res);
+    image_writer.write("whitted_res", static_cast<int>(width), n_rows, rendering_res,
+                       framebuffer, 1.0f);
     time_point end_time         = steady_clock::now();
     duration rendering_duration = end_time - begin_time;
     logger->info("rendering takes {:.6f} seconds", rendering_duration.count());
@@ -117,21 +161,25 @@ float WhittedRenderer::fresnel(const Vector3f& I, const Vector3f& N, const float
 std::optional<std::tuple<Intersection, GL::Material>> WhittedRenderer::trace(const Ray& ray,
                                                                              const Scene& scene)
 {
-    // this line below is just for compiling and can be deleted
-    (void)ray;
-
     std::optional<Intersection> payload;
-    Eigen::Matrix4f M;
     GL::Material material;
-    for (const auto& group : scene.groups) {
-        for (const auto& object : group->objects) {
-
-            // this line below is just for compiling and can be deleted
-            (void)object;
-
-            // if use bvh(exercise 2.4): use object->bvh->intersect
-            // else(exercise 2.3): use naive_intersect()
-            // pay attention to the range of payload->t
+    if (use_bvh) {
+        // the scene-level BVH only descends into objects whose bounding boxes are hit
+        auto hit = scene.tlas.intersect(ray);
+        if (hit.has_value()) {
+            payload  = std::get<0>(*hit);
+            material = std::get<1>(*hit)->mesh.material;
+        }
+    } else {
+        for (const auto& group : scene.groups) {
+            for (const auto& object : group->objects) {
+                std::optional<Intersection> result =
+                    naive_intersect(ray, object->mesh, object->model());
+                if (result.has_value() && (!payload.has_value() || result->t < payload->t)) {
+                    payload  = result;
+                    material = object->mesh.material;
+                }
+            }
         }
     }
 
@@ -141,8 +189,52 @@ std::optional<std::tuple<Intersection, GL::Material>> WhittedRenderer::trace(con
     return std::make_tuple(payload.value(), material);
 }
 
+void WhittedRenderer::trace_n(const Ray* rays, size_t n, const Scene& scene,
+                              std::optional<std::tuple<Intersection, GL::Material>>* results)
+{
+    if (!use_bvh) {
+        for (size_t i = 0; i < n; i++) {
+            results[i] = trace(rays[i], scene);
+        }
+        return;
+    }
+    // rays are handed to the TLAS one packet at a time, so the buffers live on the stack
+    std::array<Intersection, RayPacket::size> payloads;
+    std::array<Object*, RayPacket::size> objects;
+    for (size_t first = 0; first < n; first += RayPacket::size) {
+        const size_t count = std::min(RayPacket::size, n - first);
+        std::fill_n(payloads.begin(), count, Intersection());
+        scene.tlas.intersect_n(rays + first, count, payloads.data(), objects.data());
+        for (size_t i = 0; i < count; i++) {
+            if (objects[i] == nullptr) {
+                results[first + i] = std::nullopt;
+            } else {
+                results[first + i] = std::make_tuple(payloads[i], objects[i]->mesh.material);
+            }
+        }
+    }
+}
+
+bool WhittedRenderer::occluded(const Ray& ray, const Scene& scene, float t_max)
+{
+    if (use_bvh) {
+        return scene.tlas.occluded(ray, t_max);
+    }
+    for (const auto& group : scene.groups) {
+        for (const auto& object : group->objects) {
+            std::optional<Intersection> result =
+                naive_intersect(ray, object->mesh, object->model());
+            if (result.has_value() && result->t < t_max) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 // Whitted-style的光线传播算法实现
-Vector3f WhittedRenderer::cast_ray(const Ray& ray, const Scene& scene, int depth)
+Vector3f WhittedRenderer::cast_ray(const Ray& ray, const Scene& scene, int depth,
+                                   const std::optional<std::tuple<Intersection, GL::Material>>* hit)
 {
     if (depth > MAX_DEPTH) {
         return Vector3f(0.0f, 0.0f, 0.0f);
@@ -150,7 +242,7 @@ Vector3f WhittedRenderer::cast_ray(const Ray& ray, const Scene& scene, int depth
     // initialize hit color
     Vector3f hitcolor = RenderEngine::background_color;
     // get the result of trace()
-    auto result = trace(ray, scene);
+    auto result = hit != nullptr ? *hit : trace(ray, scene);
 
     // this line below is just for compiling and can be deleted
     (void)result;
@@ -161,7 +253,7 @@ Vector3f WhittedRenderer::cast_ray(const Ray& ray, const Scene& scene, int depth
     //(1)use fresnel() to get kr
     //(2)hitcolor = cast_ray*kr
     // if DIFFUSE_AND_GLOSSY:
-    //(1)compute shadow result using trace()
+    //(1)compute shadow result using occluded()
     //(2)hitcolor = diffuse*kd + specular*ks
 
     return hitcolor;
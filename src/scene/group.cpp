@@ -10,6 +10,7 @@
 #include <Eigen/Core>
 #include <fmt/format.h>
 
+#include "../render/render_engine.h"
 #include "../utils/logger.h"
 
 using Eigen::Vector3f;
@@ -117,10 +118,31 @@ bool Group::load(const string& file_path)
         }
         logger->info("summary: {} vertices, {} edges, {} faces", mesh->mNumVertices, edges.size(),
                      object.mesh.faces.count());
-        object.rebuild_BVH();
-        logger->info("The BVH structure of {} (ID: {}) has {} boxes", object.name, object.id,
-                     object.bvh->count_nodes(object.bvh->root));
         object.modified = true;
+        ++object.mesh_version;
+    }
+    // Build BVHs of all meshes in parallel, reading large ones from the disk cache when
+    // possible. Most loaded meshes are never edited, so the buffers kept for rebuilding are
+    // released. Boxes are only generated when they are shown, in the thread owning the OpenGL
+    // context.
+    ThreadPool& pool = RenderEngine::thread_pool();
+    ThreadPool::TaskGroup bvh_builds;
+    std::vector<char> cached(objects.size(), 0);
+    for (size_t i = 0; i < objects.size(); ++i) {
+        Object* target = objects[i].get();
+        char* hit      = &cached[i];
+        pool.submit(bvh_builds, [target, hit]() {
+            *hit = target->bvh->load_or_build();
+            target->bvh->release_build_memory();
+        });
+    }
+    pool.wait(bvh_builds);
+    for (size_t i = 0; i < objects.size(); ++i) {
+        Object& object = *objects[i];
+        object.mark_BVH_changed();
+        logger->info("The BVH structure of {} (ID: {}) has {} boxes (depth {}, SAH cost {:.3f}{})",
+                     object.name, object.id, object.bvh->count_nodes(), object.bvh->depth,
+                     object.bvh->sah_cost, cached[i] ? ", loaded from cache" : "");
     }
 
     return true;
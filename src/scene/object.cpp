@@ -1,5 +1,6 @@
 #include "object.h"
 
+#include <algorithm>
 #include <array>
 #include <optional>
 
@@ -32,11 +33,14 @@ std::function<KineticState(const KineticState&, const KineticState&)> Object::st
 Object::Object(const string& object_name)
     : name(object_name), center(0.0f, 0.0f, 0.0f), scaling(1.0f, 1.0f, 1.0f),
       rotation(1.0f, 0.0f, 0.0f, 0.0f), velocity(0.0f, 0.0f, 0.0f), force(0.0f, 0.0f, 0.0f),
-      mass(1.0f), BVH_boxes("BVH", GL::Mesh::highlight_wireframe_color)
+      mass(1.0f), BVH_boxes("BVH", GL::Mesh::highlight_wireframe_color),
+      world_AABB_outdated(true), BVH_refit_pending(false), BVH_rebuild_pending(false),
+      BVH_boxes_outdated(true)
 {
-    visible  = true;
-    modified = false;
-    id       = next_available_id;
+    visible      = true;
+    modified     = false;
+    mesh_version = 0;
+    id           = next_available_id;
     ++next_available_id;
     bvh                      = make_unique<BVH>(mesh);
     const string logger_name = fmt::format("{} (Object ID: {})", name, id);
@@ -45,7 +49,62 @@ Object::Object(const string& object_name)
 
 Matrix4f Object::model()
 {
-    return Matrix4f::Identity();
+    // model = translation * rotation * scaling
+    Matrix4f model          = Matrix4f::Identity();
+    model.block<3, 3>(0, 0) = rotation.toRotationMatrix() * scaling.asDiagonal();
+    model.block<3, 1>(0, 3) = center;
+    return model;
+}
+
+optional<AABB> Object::world_AABB()
+{
+    update_BVH();
+    if (!world_AABB_outdated && center == cached_center && scaling == cached_scaling &&
+        rotation.coeffs() == cached_rotation.coeffs()) {
+        return cached_world_AABB;
+    }
+    cached_center       = center;
+    cached_scaling      = scaling;
+    cached_rotation     = rotation;
+    world_AABB_outdated = false;
+    if (bvh == nullptr || bvh->nodes.empty()) {
+        cached_world_AABB = std::nullopt;
+        return cached_world_AABB;
+    }
+    // bounding box of the 8 transformed corners of the model space bounding box
+    const AABB& local = bvh->nodes.front().aabb;
+    const Matrix4f M  = model();
+    AABB world;
+    for (int i = 0; i < 8; ++i) {
+        const Vector3f corner((i & 1) ? local.p_max.x() : local.p_min.x(),
+                              (i & 2) ? local.p_max.y() : local.p_min.y(),
+                              (i & 4) ? local.p_max.z() : local.p_min.z());
+        world = union_AABB(world, (M * corner.homogeneous()).head<3>().eval());
+    }
+    cached_world_AABB = world;
+    return cached_world_AABB;
+}
+
+bool Object::in_frustum(const Matrix4f& view_projection)
+{
+    const optional<AABB> box = world_AABB();
+    if (!box.has_value()) {
+        return true;
+    }
+    // Count the corners outside each of the 6 clip planes -w <= x, y, z <= w. The object is
+    // invisible if all corners lie outside a same plane.
+    array<int, 6> n_outside{0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 8; ++i) {
+        const Vector3f corner((i & 1) ? box->p_max.x() : box->p_min.x(),
+                              (i & 2) ? box->p_max.y() : box->p_min.y(),
+                              (i & 4) ? box->p_max.z() : box->p_min.z());
+        const Eigen::Vector4f p = view_projection * corner.homogeneous();
+        for (int axis = 0; axis < 3; ++axis) {
+            n_outside[2 * axis] += p[axis] < -p.w() ? 1 : 0;
+            n_outside[2 * axis + 1] += p[axis] > p.w() ? 1 : 0;
+        }
+    }
+    return std::find(n_outside.begin(), n_outside.end(), 8) == n_outside.end();
 }
 
 void Object::update(vector<Object*>& all_objects)
@@ -68,6 +127,7 @@ void Object::update(vector<Object*>& all_objects)
             (void)v_indices;
             // v_indices 中是这条边两个端点的索引，以这两个索引为参数调用 GL::Mesh::vertex
             // 方法可以获得它们的坐标，进而用于构造射线。
+            // 使用 BVH 时可以调用 BVH::intersect_all ，把求交范围限制为这条边的长度。
             if (BVH_for_collision) {
             } else {
             }
@@ -115,19 +175,59 @@ void Object::render(const Shader& shader, WorkingMode mode, bool selected)
 
 void Object::rebuild_BVH()
 {
-    bvh->recursively_delete(bvh->root);
     bvh->build();
-    BVH_boxes.clear();
-    refresh_BVH_boxes(bvh->root);
-    BVH_boxes.to_gpu();
+    BVH_refit_pending   = false;
+    BVH_rebuild_pending = false;
+    mark_BVH_changed();
+}
+
+void Object::refit_BVH()
+{
+    if (!bvh->refit()) {
+        logger->info("BVH cannot be refitted (SAH cost {:.3f}, {:.3f} when built), rebuild it",
+                     bvh->sah_cost, bvh->built_sah_cost);
+        bvh->build();
+    }
+    BVH_refit_pending = false;
+    mark_BVH_changed();
 }
 
-void Object::refresh_BVH_boxes(BVHNode* node)
+void Object::invalidate_BVH(bool topology_changed)
 {
-    if (node == nullptr) {
+    if (topology_changed) {
+        BVH_rebuild_pending = true;
+    } else {
+        BVH_refit_pending = true;
+    }
+}
+
+void Object::update_BVH()
+{
+    if (BVH_rebuild_pending) {
+        rebuild_BVH();
+        logger->info("BVH is rebuilt with {} boxes (depth {}, SAH cost {:.3f})",
+                     bvh->count_nodes(), bvh->depth, bvh->sah_cost);
+    } else if (BVH_refit_pending) {
+        refit_BVH();
+    }
+}
+
+void Object::mark_BVH_changed()
+{
+    BVH_boxes_outdated  = true;
+    world_AABB_outdated = true;
+}
+
+void Object::update_BVH_boxes()
+{
+    update_BVH();
+    if (!BVH_boxes_outdated) {
         return;
     }
-    BVH_boxes.add_AABB(node->aabb.p_min, node->aabb.p_max);
-    refresh_BVH_boxes(node->left);
-    refresh_BVH_boxes(node->right);
+    BVH_boxes.clear();
+    for (const BVHNode& node : bvh->nodes) {
+        BVH_boxes.add_AABB(node.aabb.p_min, node.aabb.p_max);
+    }
+    BVH_boxes.to_gpu();
+    BVH_boxes_outdated = false;
 }
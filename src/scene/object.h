@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <string>
 #include <memory>
+#include <optional>
 #include <vector>
 #include <functional>
 
@@ -48,6 +49,25 @@ public:
     ~Object() = default;
     /*! \~chinese 此物体的模型变换矩阵 (Model Transform Matrix)。 */
     Eigen::Matrix4f model();
+    /*!
+     * \~chinese
+     * \brief 此物体在世界坐标系下的轴对齐包围盒。
+     *
+     * 由 BVH 根节点的包围盒（模型坐标系）经模型变换矩阵变换得到。结果会被缓存，
+     * 只有 `center`、`rotation`、`scaling` 改变或重新构建 BVH 之后才会重新计算。
+     * 尚未构建 BVH （或 mesh 为空）时返回 `std::nullopt` 。
+     */
+    std::optional<AABB> world_AABB();
+    /*!
+     * \~chinese
+     * \brief 判断物体是否可能出现在给定的视锥体内。
+     *
+     * 用世界坐标系下的包围盒做保守的测试：包围盒的 8 个顶点都在裁剪空间中同一个平面外侧时
+     * 返回 false ，此时物体一定不可见。没有包围盒时总是返回 true 。
+     *
+     * \param view_projection 相机的 projection * view 矩阵
+     */
+    bool in_frustum(const Eigen::Matrix4f& view_projection);
     /*!
      * \~chinese
      * \brief 更新下一个时间步的运动状态。
@@ -76,6 +96,44 @@ public:
      * 原先没有构建过 BVH 的情况下调用这个函数也是安全的。
      */
     void rebuild_BVH();
+    /*!
+     * \~chinese
+     * \brief 顶点移动而连接关系不变时更新 BVH 。
+     *
+     * 先尝试 `BVH::refit` ，只有无法 refit 或树的质量下降过多时才重新构建。
+     */
+    void refit_BVH();
+    /*!
+     * \~chinese
+     * \brief 标记 BVH 与 mesh 不再一致，但不立即更新。
+     *
+     * 编辑 mesh 时每一帧都可能修改顶点，因此这里只记录需要做的更新，
+     * 等到下一次使用 BVH 时再由 `update_BVH` 一次完成。
+     *
+     * \param topology_changed 面片的连接关系是否改变。改变时必须重新构建，否则 refit 即可。
+     */
+    void invalidate_BVH(bool topology_changed);
+    /*!
+     * \~chinese
+     * \brief 完成 `invalidate_BVH` 记录的更新，BVH 已经与 mesh 一致时什么也不做。
+     *
+     * 所有使用 BVH 的地方（拾取、场景的 TLAS 和包围盒）都应先调用这个函数。
+     */
+    void update_BVH();
+    /*!
+     * \~chinese
+     * \brief BVH 在 `Object` 之外被构建或读取后调用，标记线框和世界坐标系包围盒需要重新计算。
+     */
+    void mark_BVH_changed();
+    /*!
+     * \~chinese
+     * \brief 根据当前的 BVH 重新生成代表包围盒的线框并同步到显存。
+     *
+     * 只有 BVH 在上一次调用后改变过才会重新生成，因此只需在显示 BVH 时每帧调用。
+     * 这个函数会调用 OpenGL API ，只能在持有 OpenGL 上下文的线程中调用；
+     * 而 `BVH::build` 本身不涉及 OpenGL ，可以在其他线程中执行。
+     */
+    void update_BVH_boxes();
 
     /*!
      * \~chinese
@@ -94,6 +152,14 @@ public:
     bool visible;
     /*! \~chinese 表示上一帧过后是否被修改，在第一次加载后或与半边网格不一致时为真。 */
     bool modified;
+    /*!
+     * \~chinese
+     * \brief mesh 数据的版本号，mesh 的顶点或面片每次被修改后加一。
+     *
+     * 与 `modified` 不同，它不会在数据同步到显存后被重置，
+     * 软光栅渲染器用它判断缓存的顶点缓冲是否过期。
+     */
+    std::size_t mesh_version;
     ///@{
     /*! \~chinese 物体的位姿属性，用于构造它的模型变换矩阵 (Model Transform Matrix)。 */
     Eigen::Vector3f center;
@@ -121,17 +187,33 @@ public:
      *
      * 物体的 BVH 在它的 mesh 加载完成后构建。由于 mesh 数据的加载过程是在 `Group::load`
      * 中完成的，构建 BVH 的函数调用也只能在这个函数（而不是在 `Object` 的构造函数）中进行。
+     * 较大的 mesh 的 BVH 会缓存在磁盘上，再次加载同一个模型时直接读取（见 `BVH::load_or_build`）。
      *
      * 物体的 mesh 数据都在模型坐标系下，因此 BVH 也是建立在模型坐标系下的。这意味着物体的平移、
-     * 旋转和缩放都不改变 BVH 的结构，只有物体发生形变时才需要更新 BVH 。目前的实现是：
-     * 每次退出建模模式时，不加检查地删除原先的 BVH 并重新构建。
+     * 旋转和缩放都不改变 BVH 的结构，只有物体发生形变时才需要更新 BVH ：编辑 mesh 后由
+     * `invalidate_BVH` 标记，在下一次使用前由 `update_BVH` 更新。
      */
     std::unique_ptr<BVH> bvh;
     /*! \~chinese 代表 BVH 所有包围盒的线框。 */
     GL::LineSet BVH_boxes;
 
 private:
-    void refresh_BVH_boxes(BVHNode* node);
+    /*! \~chinese 缓存的世界坐标系包围盒，没有包围盒时为空。 */
+    std::optional<AABB> cached_world_AABB;
+    ///@{
+    /*! \~chinese 计算缓存的包围盒时物体的位姿属性，用于判断缓存是否过期。 */
+    Eigen::Vector3f cached_center;
+    Eigen::Vector3f cached_scaling;
+    Eigen::Quaternionf cached_rotation;
+    ///@}
+    /*! \~chinese 缓存的包围盒是否需要重新计算（例如 BVH 被重新构建）。 */
+    bool world_AABB_outdated;
+    /*! \~chinese BVH 是否需要 refit 。 */
+    bool BVH_refit_pending;
+    /*! \~chinese BVH 是否需要重新构建，为真时不必再 refit 。 */
+    bool BVH_rebuild_pending;
+    /*! \~chinese `BVH_boxes` 是否需要重新生成。 */
+    bool BVH_boxes_outdated;
     /*! \~chinese 下一个可用的物体 ID 。 */
     static std::size_t next_available_id;
     /*! \~chinese 日志记录器。 */
@@ -239,7 +239,7 @@ bool Scene::check_during_simulation()
     return during_animation;
 }
 
-void Scene::render(const Shader& shader, WorkingMode mode)
+void Scene::render(const Shader& shader, WorkingMode mode, const Matrix4f& view_projection)
 {
     shader.set_uniform("color_per_vertex", false);
     shader.set_uniform("global_color", GL::Mesh::default_wireframe_color);
@@ -247,11 +247,8 @@ void Scene::render(const Shader& shader, WorkingMode mode)
     if (mode != WorkingMode::MODEL && halfedge_mesh) {
         logger->info("the halfedge mesh is destructed.");
         halfedge_mesh.reset(nullptr);
-        logger->info("re-build BVH for the edited object");
-        selected_object->rebuild_BVH();
-        logger->info("The BVH structure of {} (ID: {}) has {} boxes", selected_object->name,
-                     selected_object->id,
-                     selected_object->bvh->count_nodes(selected_object->bvh->root));
+        // apply the refit or rebuild deferred by the synchronizations of the edited object
+        selected_object->update_BVH();
     }
     for (auto& group : groups) {
         for (auto& object : group->objects) {
@@ -263,8 +260,9 @@ void Scene::render(const Shader& shader, WorkingMode mode)
                     logger->warn("failed to build a halfedge mesh for the current object");
                 }
             }
-            // Only render the selected object for Model mode.
-            if (mode != WorkingMode::MODEL || selected) {
+            // Only render the selected object for Model mode, which is placed at the origin
+            // regardless of its pose. Objects of other modes are culled by their bounding boxes.
+            if (mode == WorkingMode::MODEL ? selected : object->in_frustum(view_projection)) {
                 object->render(shader, mode, selected);
             }
         }
@@ -16,6 +16,7 @@
 #include "../platform/gl.hpp"
 #include "../platform/shader.hpp"
 #include "../utils/rendering.hpp"
+#include "../utils/tlas.h"
 #include "../geometry/halfedge.h"
 
 /*!
@@ -73,9 +74,14 @@ public:
      * \brief 绘制整个场景。
      *
      * `render` 方法是场景对外的绘制接口，不会直接绘制任何内容，只负责调用每个 Object 的 `render`
-     * 方法、`render_camera` 和 `render_lights` 方法。
+     * 方法、`render_camera` 和 `render_lights` 方法。除建模模式外，包围盒完全在视锥体之外的物体
+     * 不会被绘制。
+     *
+     * \param shader 绘制使用的着色器
+     * \param mode 当前的工作模式
+     * \param view_projection 观察相机的 projection * view 矩阵，用于剔除不可见的物体
      */
-    void render(const Shader& shader, WorkingMode mode);
+    void render(const Shader& shader, WorkingMode mode, const Eigen::Matrix4f& view_projection);
 
     /*! \~chinese 场景中所有的物体组。 */
     std::vector<std::unique_ptr<Group>> groups;
@@ -92,6 +98,13 @@ public:
     std::list<Light> lights;
     /*! \~chinese 用于建模模式的半边网格。 */
     std::unique_ptr<HalfedgeMesh> halfedge_mesh;
+    /*!
+     * \~chinese
+     * \brief 场景中所有物体的顶层 BVH ，用于光线追踪和拾取物体。
+     *
+     * 使用前应调用 `TLAS::update` ，使它与物体的增删和移动保持一致。
+     */
+    TLAS tlas;
 
 private:
     /*! \~chinese
@@ -1,9 +1,12 @@
 #include "controller.h"
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <string>
 #include <vector>
 #include <array>
+#include <tuple>
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
@@ -13,6 +16,7 @@
 #include <glad/glad.h>
 #include <imgui/imgui.h>
 
+#include "../utils/bvh.h"
 #include "../utils/math.hpp"
 #include "../utils/ray.h"
 #include "../utils/rendering.hpp"
@@ -246,7 +250,7 @@ void Controller::render(const Shader& shader)
         controller.main_camera->projection() * controller.main_camera->view();
     shader.set_uniform("view_projection", view_projection);
     shader.set_uniform("camera_position", controller.main_camera->position);
-    controller.scene->render(shader, mode);
+    controller.scene->render(shader, mode, view_projection);
 
     render_selected_element(shader);
     render_debug_helpers(shader);
@@ -359,6 +363,7 @@ void Controller::render_debug_helpers(const Shader& shader)
     if (debug_options.show_BVH) {
         for (auto& group : scene->groups) {
             for (auto& object : group->objects) {
+                object->update_BVH_boxes();
                 shader.set_uniform("model", object->model());
                 object->BVH_boxes.render(shader);
             }
@@ -368,24 +373,12 @@ void Controller::render_debug_helpers(const Shader& shader)
 
 void Controller::pick_object(Ray& ray)
 {
-    optional<Intersection> hit = std::nullopt;
-    Object* hit_object         = nullptr;
-    // Test all objects and maintain the minimal t value.
-    for (auto& group : scene->groups) {
-        for (auto& object : group->objects) {
-            Matrix4f model                = object->model();
-            GL::Mesh& mesh                = object->mesh;
-            optional<Intersection> result = object->bvh->intersect(ray, mesh, model);
-            if (!result.has_value()) {
-                continue;
-            }
-            if (!hit.has_value() || hit.value().t > result.value().t) {
-                hit        = result;
-                hit_object = object.get();
-            }
-        }
-    }
+    // Only objects whose bounding boxes are hit are tested against their own BVHs, and the
+    // nearest intersection is kept.
+    scene->tlas.update(scene->groups);
+    const auto hit = scene->tlas.intersect(ray);
     if (hit.has_value()) {
+        Object* hit_object = std::get<1>(*hit);
         logger->debug("object {} (ID: {}) is picked", hit_object->name, hit_object->id);
         select(hit_object);
     } else {
@@ -400,46 +393,70 @@ void Controller::pick_element(Ray& ray)
     }
     logger->debug("perform picking on object \"{}\" (ID: {})", scene->selected_object->name,
                   scene->selected_object->id);
-    GL::Mesh& mesh             = scene->selected_object->mesh;
-    optional<Intersection> hit = naive_intersect(ray, mesh, I4f);
+    GL::Mesh& mesh = scene->selected_object->mesh;
+    // The halfedge mesh is edited in model coordinates, and the BVH is brought up to date with
+    // the edits HalfedgeMesh::sync has recorded.
+    scene->selected_object->update_BVH();
+    const BVH& bvh = *(scene->selected_object->bvh);
+    optional<Intersection> hit = bvh.intersect(ray, mesh, I4f);
     if (hit.has_value()) {
         size_t face_index        = hit.value().face_index;
         Vector3f& w              = hit.value().barycentric_coord;
         array<size_t, 3> indices = mesh.face(face_index);
-        size_t max_weight_index  = 0;
-        size_t min_weight_index  = 0;
         logger->debug("hit face {} with barycentric coordinates {:.3f}", face_index, w);
-        for (size_t i = 1; i < 3; ++i) {
-            if (w(i) > w(max_weight_index)) {
-                max_weight_index = i;
-            }
-            if (w(i) < w(min_weight_index)) {
-                min_weight_index = i;
-            }
+        // the world-space size of a pixel at the hit point
+        const Vector3f point   = ray.origin + hit.value().t * ray.direction;
+        const float distance   = (point - ray.origin).norm();
+        const float half_fov   = radians(main_camera->fov_y_degrees) / 2.0f;
+        const float pixel_size = 2.0f * distance * std::tan(half_fov) / window_height;
+        float shortest_edge    = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < 3; ++i) {
+            const Vector3f edge = mesh.vertex(indices[(i + 1) % 3]) - mesh.vertex(indices[i]);
+            shortest_edge       = std::min(shortest_edge, edge.norm());
         }
-        if (w(max_weight_index) > 0.9f) {
-            const size_t selected_vertex_index = indices[max_weight_index];
+        const float radius =
+            std::min(picking_radius * pixel_size, max_picking_ratio * shortest_edge);
+        // Only elements of the hit face are candidates: a vertex or an edge of another face
+        // may lie within the radius across a thin sheet or on a fold behind the hit point.
+        const auto incident = [&indices](size_t vertex_index) {
+            return std::find(indices.begin(), indices.end(), vertex_index) != indices.end();
+        };
+        optional<Proximity> vertex = bvh.nearest_vertex(point, radius);
+        if (vertex.has_value() && incident(mesh.face(vertex->face_index)[vertex->element])) {
+            const size_t selected_vertex_index = mesh.face(vertex->face_index)[vertex->element];
             logger->debug("try to select vertex {}",
                           scene->halfedge_mesh->v_pointers[selected_vertex_index]->id);
             select(scene->halfedge_mesh->v_pointers[selected_vertex_index]);
             return;
-        } else if (w(min_weight_index) < 0.1f) {
-            const size_t index1 = indices[(min_weight_index + 1) % 3];
-            const size_t index2 = indices[(min_weight_index + 2) % 3];
-            Vertex* v1          = scene->halfedge_mesh->v_pointers[index1];
-            Vertex* v2          = scene->halfedge_mesh->v_pointers[index2];
-            Halfedge* h         = v1->halfedge;
-            while (h->inv->from != v2) {
-                h = h->inv->next;
-            };
-            if (w(min_weight_index) > 0.05f) {
-                logger->debug("try to select halfedge {}", h->id);
-                select(h);
-            } else {
-                logger->debug("try to select edge {}", h->edge->id);
-                select(h->edge);
+        }
+        optional<Proximity> edge = bvh.nearest_edge(point, radius);
+        if (edge.has_value()) {
+            const array<size_t, 3> edge_face = mesh.face(edge->face_index);
+            const size_t a                   = edge_face[edge->element];
+            const size_t b                   = edge_face[(edge->element + 1) % 3];
+            if (incident(a) && incident(b)) {
+                // the edge may have been reported by the neighbouring face, so the halfedge is
+                // the one running along the order of the hit face, which belongs to it
+                size_t k = 0;
+                while (indices[k] == a || indices[k] == b) {
+                    ++k;
+                }
+                const size_t first = (k + 1) % 3;
+                Vertex* v1         = scene->halfedge_mesh->v_pointers[indices[first]];
+                Vertex* v2         = scene->halfedge_mesh->v_pointers[indices[(first + 1) % 3]];
+                Halfedge* h        = v1->halfedge;
+                while (h->inv->from != v2) {
+                    h = h->inv->next;
+                };
+                if (edge->distance > 0.5f * radius) {
+                    logger->debug("try to select halfedge {}", h->id);
+                    select(h);
+                } else {
+                    logger->debug("try to select edge {}", h->edge->id);
+                    select(h->edge);
+                }
+                return;
             }
-            return;
         }
         Vertex* v1  = scene->halfedge_mesh->v_pointers[indices[0]];
         Vertex* v2  = scene->halfedge_mesh->v_pointers[indices[1]];
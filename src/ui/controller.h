@@ -167,7 +167,11 @@ private:
      * \~chinese
      * \brief 拾取半边、顶点、边或面片。
      *
-     * 在建模模式下，根据射线求交的结果选择半边网格上的基本元素。
+     * 在建模模式下，根据射线求交的结果选择半边网格上的基本元素。射线与物体的 BVH 求交，
+     * 再用 `BVH::nearest_vertex` 和 `BVH::nearest_edge` 查找离交点最近的顶点和边，
+     * 不属于被点中面片的顶点和边（例如薄片另一侧的）不会被选中：
+     * 拾取范围是 `picking_radius` 个像素，但不超过被点中面片最短边长的 `max_picking_ratio` 倍。
+     * 边的范围分为两半，离边较近的一半选中边，较远的一半选中面片内侧的半边。
      * \param ray 根据点击位置生成的射线（世界坐标系下）
      */
     void pick_element(Ray& ray);
@@ -209,6 +213,10 @@ private:
     static constexpr float wheel_scroll_factor = 0.8f;
     /*! \~chinese 平移视角时屏幕坐标到观察坐标换算系数的固定部分。 */
     static constexpr float mouse_translation_factor = 0.001f;
+    /*! \~chinese 建模模式下拾取顶点和边的范围（像素）。 */
+    static constexpr float picking_radius = 8.0f;
+    /*! \~chinese 拾取范围相对于被点中面片最短边长的上限，使密集的网格上仍然能选中面片。 */
+    static constexpr float max_picking_ratio = 0.1f;
     /*! \~chinese 构造函数是私有的。 */
     Controller();
     /*!
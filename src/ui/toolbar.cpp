@@ -2,9 +2,11 @@
 
 #include <cmath>
 #include <cstdio>
+#include <fstream>
 #include <limits>
 #include <string>
 #include <variant>
+#include <vector>
 #include <optional>
 
 #include <imgui/imgui.h>
@@ -42,6 +44,18 @@ constexpr float ANGLE_UNIT    = 0.2f;
 constexpr float SCALING_UNIT  = 0.1f;
 constexpr float PHYSICS_UNIT  = 0.01f;
 
+// 把统计结果写入当前工作目录下的 JSON 文件
+static void dump_json(const string& path, const string& json)
+{
+    std::ofstream file(path);
+    file << json << '\n';
+    if (file) {
+        spdlog::info("statistics saved to {}", path);
+    } else {
+        spdlog::warn("failed to write {}", path);
+    }
+}
+
 Toolbar::Toolbar(WorkingMode& mode, const SelectableType& selected_element)
     : mode(mode), selected_element(selected_element)
 {
@@ -186,6 +200,24 @@ void Toolbar::layout_mode(Scene& scene)
             selected_object->rotation = AngleAxisf(radians(x_angle), Vector3f::UnitX()) *
                                         AngleAxisf(radians(y_angle), Vector3f::UnitY()) *
                                         AngleAxisf(radians(z_angle), Vector3f::UnitZ());
+            // takes effect the next time the BVH of this object is rebuilt
+            ImGui::SeparatorText("BVH");
+            ImGui::Checkbox("Parallel Construction", &selected_object->bvh->parallel_build);
+            const BVHStats& stats = selected_object->bvh->stats;
+            ImGui::Text("%zu nodes, %zu leaves", stats.n_nodes, stats.n_leaves);
+            ImGui::Text("depth %zu (leaves %.1f on average)", stats.max_depth,
+                        stats.average_depth);
+            ImGui::Text("SAH cost %.3f, overlap %.3f", stats.sah_cost, stats.overlap);
+            ImGui::Text("built in %.3f s, %.2f MiB", stats.build_time,
+                        static_cast<double>(stats.memory) / (1024.0 * 1024.0));
+            std::vector<float> leaf_sizes(stats.leaf_size_histogram.begin(),
+                                          stats.leaf_size_histogram.end());
+            ImGui::PlotHistogram("Leaf Sizes", leaf_sizes.data(),
+                                 static_cast<int>(leaf_sizes.size()), 0, nullptr, 0.0f, FLOAT_INF,
+                                 ImVec2(0.0f, px(40.0f)));
+            if (ImGui::Button("Dump BVH Stats")) {
+                dump_json(format("bvh_stats_{}.json", selected_object->id), stats.to_json());
+            }
         }
         ImGui::EndTabItem();
     }
@@ -335,7 +367,8 @@ void Toolbar::model_mode(Scene& scene)
 }
 
 const char* renderer_names[] = {"Rasterizer Renderer", "Rasterizer Renderer (MT)",
-                                "Whitted-Style Ray-Tracer"};
+                                "Rasterizer Renderer (Deferred)", "Whitted-Style Ray-Tracer"};
+const char* image_format_names[] = {"None", "PPM (Binary)", "PNG", "PFM (Float32)"};
 
 void Toolbar::render_mode(Scene& scene)
 {
@@ -353,20 +386,49 @@ void Toolbar::render_mode(Scene& scene)
         static int renderer_index            = 0;
         static RendererType current_renderer = RendererType::RASTERIZER;
 
-        ImGui::Combo("Renderer", &renderer_index, renderer_names, 3);
+        ImGui::Combo("Renderer", &renderer_index, renderer_names, 4);
         switch (renderer_index) {
         case 0: current_renderer = RendererType::RASTERIZER; break;
         case 1: current_renderer = RendererType::RASTERIZER_MT; break;
-        case 2: current_renderer = RendererType::WHITTED_STYLE; break;
+        case 2: current_renderer = RendererType::RASTERIZER_DEFERRED; break;
+        case 3: current_renderer = RendererType::WHITTED_STYLE; break;
         default: break;
         }
-        if (current_renderer == RendererType::RASTERIZER_MT) {
+        // every renderer except the single-threaded rasterizer splits its work over the pool
+        if (current_renderer != RendererType::RASTERIZER) {
             ImGui::SetNextItemWidth(0.5f * ImGui::CalcItemWidth());
             ImGui::InputInt("Number of Threads", &render_engine.n_threads);
         }
+        if (current_renderer != RendererType::WHITTED_STYLE) {
+            ImGui::Checkbox("Early Depth Test", &render_engine.rasterizer_render->early_z);
+            ImGui::Checkbox("Backface Culling", &render_engine.rasterizer_render->backface_culling);
+        }
         if (current_renderer == RendererType::WHITTED_STYLE) {
             ImGui::Checkbox("Use BVH for Acceleration", &render_engine.whitted_render->use_bvh);
+            TraversalCounters& counters = BVH::traversal_counters;
+            bool counting               = counters.enabled.load();
+            if (ImGui::Checkbox("Count BVH Traversal", &counting)) {
+                counters.enabled.store(counting);
+            }
+            if (counting) {
+                const std::uint64_t rays = counters.rays.load();
+                const double per_ray     = rays > 0 ? 1.0 / static_cast<double>(rays) : 0.0;
+                ImGui::Text("%llu rays, %.1f nodes and %.1f triangles per ray",
+                            static_cast<unsigned long long>(rays),
+                            static_cast<double>(counters.nodes_visited.load()) * per_ray,
+                            static_cast<double>(counters.triangles_tested.load()) * per_ray);
+                if (ImGui::Button("Reset Counters")) {
+                    counters.reset();
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Dump Counters")) {
+                    dump_json("bvh_traversal.json", counters.to_json());
+                }
+            }
         }
+        static int image_format_index = static_cast<int>(render_engine.image_writer.format);
+        ImGui::Combo("Output Image", &image_format_index, image_format_names, 4);
+        render_engine.image_writer.format = static_cast<ImageFormat>(image_format_index);
         ImGui::ColorEdit3("Background Color", RenderEngine::background_color.data(),
                           ImGuiColorEditFlags_NoInputs);
         ImGui::SameLine();
@@ -1,6 +1,8 @@
 #include "aabb.h"
 
+#include <algorithm>
 #include <array>
+#include <utility>
 
 #include <Eigen/Geometry>
 
@@ -36,20 +38,43 @@ int AABB::max_extent() const
         return 2;
 }
 // 返回AABB的中心点
-Vector3f AABB::centroid()
+Vector3f AABB::centroid() const
 {
     return 0.5 * p_min + 0.5 * p_max;
 }
+// 返回AABB的表面积
+float AABB::surface_area() const
+{
+    const Vector3f d = diagonal();
+    if (d.x() < 0.0f || d.y() < 0.0f || d.z() < 0.0f) {
+        return 0.0f;
+    }
+    return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
 // 判断当前射线是否与当前AABB相交
-bool AABB::intersect(const Ray& ray, const Vector3f& inv_dir, const std::array<int, 3>& dir_is_neg)
+bool AABB::intersect(const Ray& ray, const Vector3f& inv_dir,
+                     const std::array<int, 3>& dir_is_neg) const
 {
-    // these lines below are just for compiling and can be deleted
-    (void)ray;
-    (void)inv_dir;
-    (void)dir_is_neg;
-    return true;
-    // these lines above are just for compiling and can be deleted
-
+    return intersect(ray, inv_dir, dir_is_neg, std::numeric_limits<float>::max());
+}
+// 判断当前射线在给定范围内是否与当前AABB相交
+bool AABB::intersect(const Ray& ray, const Vector3f& inv_dir,
+                     const std::array<int, 3>& dir_is_neg, float t_max) const
+{
+    // slab test: the ray enters the box after entering all three slabs and leaves it after
+    // leaving any of them
+    float t_enter = std::numeric_limits<float>::lowest();
+    float t_exit  = t_max;
+    for (int i = 0; i < 3; i++) {
+        float t_near = (p_min[i] - ray.origin[i]) * inv_dir[i];
+        float t_far  = (p_max[i] - ray.origin[i]) * inv_dir[i];
+        if (dir_is_neg[i]) {
+            std::swap(t_near, t_far);
+        }
+        t_enter = std::max(t_enter, t_near);
+        t_exit  = std::min(t_exit, t_far);
+    }
+    return t_enter <= t_exit && t_exit >= 0.0f;
 }
 // 获取当前图元对应AABB
 AABB get_aabb(const GL::Mesh& mesh, size_t face_idx)
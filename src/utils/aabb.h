@@ -35,7 +35,9 @@ public:
     /*! \~chinese 返回AABB的x,y,z中最长的一维 */
     int max_extent() const;
     /*! \~chinese 返回AABB的中心坐标 */
-    Eigen::Vector3f centroid();
+    Eigen::Vector3f centroid() const;
+    /*! \~chinese 返回AABB的表面积，空的AABB返回0 */
+    float surface_area() const;
 
     /*
     AABB intersect(const AABB& b);
@@ -54,7 +56,14 @@ public:
      * \param dir_is_neg 判断x,y,z方向是否为负，为负则交换t_min和t_max
      */
     bool intersect(const Ray& ray, const Eigen::Vector3f& inv_dir,
-                   const std::array<int, 3>& dir_is_neg);
+                   const std::array<int, 3>& dir_is_neg) const;
+    /*!
+     * \~chinese
+     * \brief 判断射线在 \f$t \in [0, t_{max}]\f$ 的范围内是否与AABB相交，
+     * 用于跳过比已知交点更远的包围盒
+     */
+    bool intersect(const Ray& ray, const Eigen::Vector3f& inv_dir,
+                   const std::array<int, 3>& dir_is_neg, float t_max) const;
 };
 
 /*! \~chinese
@@ -1,104 +1,1522 @@
 #include "bvh.h"
 
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <optional>
+#include <type_traits>
 
 #include <Eigen/Geometry>
 #include "formatter.hpp"
 #include <spdlog/spdlog.h>
 
 #include "math.hpp"
+#include "../render/render_engine.h"
+#include "../render/simd.h"
 
+namespace fs = std::filesystem;
+using duration = std::chrono::duration<float>;
 using Eigen::Vector3f;
 using std::optional;
 using std::vector;
+using std::chrono::steady_clock;
 
-BVHNode::BVHNode() : left(nullptr), right(nullptr), face_idx(0)
+namespace {
+
+// SAH 中遍历一个内部节点和与一个面片求交的相对代价
+constexpr float traversal_cost    = 1.0f;
+constexpr float intersection_cost = 1.0f;
+// 每个坐标轴上划分的桶数
+constexpr size_t n_bins = 16;
+// Below this depth nodes are split by SAH, deeper nodes are split evenly. This bounds the
+// depth of a tree by 64 even for pathological inputs, so traversal can use a fixed stack.
+constexpr size_t max_sah_depth = 32;
+constexpr size_t max_depth     = 64;
+
+struct Bin
 {
+    AABB aabb;
+    size_t count = 0;
+};
+
+// union_AABB 的原地版本，构建时调用次数很多，放在这里以便内联
+inline void expand(AABB& box, const AABB& other)
+{
+    box.p_min = box.p_min.cwiseMin(other.p_min);
+    box.p_max = box.p_max.cwiseMax(other.p_max);
 }
 
-BVH::BVH(const GL::Mesh& mesh) : root(nullptr), mesh(mesh)
+inline void expand(AABB& box, const Vector3f& p)
+{
+    box.p_min = box.p_min.cwiseMin(p);
+    box.p_max = box.p_max.cwiseMax(p);
+}
+
+// 比这个值更近的交点被忽略，避免射线与它的起点所在的面片相交
+constexpr float min_t = 1e-5f;
+
+// A ray prepared for the watertight test of Woop et al. [2013]: the triangles are translated
+// to the origin, then sheared and scaled so that the ray becomes the unit +z axis. Unlike
+// Moller-Trumbore, rays through shared edges and vertices never slip between two faces.
+struct ShearedRay
+{
+    std::array<float, 3> origin;
+    int kx, ky, kz;
+    float sx, sy, sz;
+};
+
+inline ShearedRay shear(const Ray& ray)
+{
+    ShearedRay sheared;
+    const Vector3f abs_dir = ray.direction.cwiseAbs();
+    abs_dir.maxCoeff(&sheared.kz);
+    sheared.kx = (sheared.kz + 1) % 3;
+    sheared.ky = (sheared.kx + 1) % 3;
+    // faces are hit from both sides, so the winding does not need to be kept here
+    sheared.sx = ray.direction[sheared.kx] / ray.direction[sheared.kz];
+    sheared.sy = ray.direction[sheared.ky] / ray.direction[sheared.kz];
+    sheared.sz = 1.0f / ray.direction[sheared.kz];
+    for (int axis = 0; axis < 3; axis++) {
+        sheared.origin[axis] = ray.origin[axis];
+    }
+    return sheared;
+}
+
+// The closest face found so far. index is the position in BVH::primitives, and u, v are the
+// barycentric weights of the first two vertices.
+struct TriangleHit
+{
+    float t      = std::numeric_limits<float>::max();
+    size_t index = 0;
+    float u      = 0.0f;
+    float v      = 0.0f;
+};
+
+// Test the FloatLanes::width faces starting at `first` together, and return a mask whose i-th
+// bit is set if the ray hits the i-th face within (min_t, t_max]. With barycentrics, the t and
+// the barycentric weights of the first two vertices are written for every face; without them
+// only the mask is computed, which is all shadow rays need.
+template<bool with_barycentrics>
+inline int intersect_triangles(const TriangleStore& store, size_t first, const ShearedRay& ray,
+                               float t_max, float* t = nullptr, float* u = nullptr,
+                               float* v = nullptr)
+{
+    const FloatLanes zero = FloatLanes::broadcast(0.0f);
+    const FloatLanes sx   = FloatLanes::broadcast(ray.sx);
+    const FloatLanes sy   = FloatLanes::broadcast(ray.sy);
+    const FloatLanes sz   = FloatLanes::broadcast(ray.sz);
+    std::array<FloatLanes, 3> x, y, z;
+    for (int k = 0; k < 3; k++) {
+        const auto coordinate = [&](int axis) {
+            return FloatLanes::load(store.vertices[3 * k + axis].data() + first) -
+                   FloatLanes::broadcast(ray.origin[axis]);
+        };
+        const FloatLanes pz = coordinate(ray.kz);
+        x[k]                = coordinate(ray.kx) - sx * pz;
+        y[k]                = coordinate(ray.ky) - sy * pz;
+        z[k]                = sz * pz;
+    }
+    // scaled barycentric coordinates, which are edge functions of the projected triangle
+    const FloatLanes e0 = x[2] * y[1] - y[2] * x[1];
+    const FloatLanes e1 = x[0] * y[2] - y[0] * x[2];
+    const FloatLanes e2 = x[1] * y[0] - y[1] * x[0];
+    const int all_non_negative =
+        e0.non_negative_mask() & e1.non_negative_mask() & e2.non_negative_mask();
+    const int all_non_positive = (zero - e0).non_negative_mask() &
+                                 (zero - e1).non_negative_mask() & (zero - e2).non_negative_mask();
+    const FloatLanes det = e0 + e1 + e2;
+    const int det_zero   = det.non_negative_mask() & (zero - det).non_negative_mask();
+    int mask             = (all_non_negative | all_non_positive) & ~det_zero;
+    if (mask == 0) {
+        return 0;
+    }
+    const FloatLanes inv_det = FloatLanes::broadcast(1.0f) / det;
+    const FloatLanes hit_t   = (e0 * z[0] + e1 * z[1] + e2 * z[2]) * inv_det;
+    mask &= (hit_t - FloatLanes::broadcast(min_t)).non_negative_mask() &
+            (FloatLanes::broadcast(t_max) - hit_t).non_negative_mask();
+    if constexpr (with_barycentrics) {
+        hit_t.store(t);
+        (e0 * inv_det).store(u);
+        (e1 * inv_det).store(v);
+    }
+    return mask;
+}
+
+// Find the closest face among [first, first + count) nearer than hit.t, and return whether hit
+// was updated.
+inline bool intersect_leaf(const TriangleStore& store, size_t first, size_t count,
+                           const ShearedRay& ray, TriangleHit& hit)
+{
+    bool found = false;
+    for (size_t k = first; k < first + count; k += FloatLanes::width) {
+        alignas(32) std::array<float, FloatLanes::width> t, u, v;
+        const int mask =
+            intersect_triangles<true>(store, k, ray, hit.t, t.data(), u.data(), v.data());
+        const size_t n = std::min<size_t>(FloatLanes::width, first + count - k);
+        for (size_t i = 0; i < n; i++) {
+            if (((mask >> i) & 1) && t[i] < hit.t) {
+                hit   = {t[i], k + i, u[i], v[i]};
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+// Return whether any face among [first, first + count) is hit within (min_t, t_max].
+inline bool occluded_leaf(const TriangleStore& store, size_t first, size_t count,
+                          const ShearedRay& ray, float t_max)
+{
+    for (size_t k = first; k < first + count; k += FloatLanes::width) {
+        const int mask = intersect_triangles<false>(store, k, ray, t_max);
+        const size_t n = std::min<size_t>(FloatLanes::width, first + count - k);
+        if (mask & ((1 << n) - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Clip [t_min, t_max] to the part of the ray inside the box, and return whether anything is
+// left. t_enter is then the distance at which the ray enters the box.
+inline bool entry_distance(const AABB& box, const Ray& ray, const Vector3f& inv_dir, float t_min,
+                           float t_max, float& t_enter)
+{
+    for (int i = 0; i < 3; i++) {
+        const float t_lower = (box.p_min[i] - ray.origin[i]) * inv_dir[i];
+        const float t_upper = (box.p_max[i] - ray.origin[i]) * inv_dir[i];
+        t_min               = std::max(t_min, std::min(t_lower, t_upper));
+        t_max               = std::min(t_max, std::max(t_lower, t_upper));
+    }
+    t_enter = t_min;
+    return t_min <= t_max;
+}
+
+// 按 TriangleStore 中的顺序取出第 i 个面片的第 k 个顶点
+inline Vector3f stored_vertex(const TriangleStore& store, size_t i, int k)
+{
+    const auto& v = store.vertices;
+    return Vector3f(v[3 * k][i], v[3 * k + 1][i], v[3 * k + 2][i]);
+}
+
+// 点到包围盒的距离，点在包围盒内时为 0
+inline float box_distance(const AABB& box, const Vector3f& point)
+{
+    return (point - point.cwiseMax(box.p_min).cwiseMin(box.p_max)).norm();
+}
+
+// 把模型坐标系下的最近交点转换为 Intersection
+inline Intersection make_intersection(const TriangleStore& store, const vector<size_t>& primitives,
+                                      const TriangleHit& hit)
+{
+    const size_t i = hit.index;
+    const auto& n  = store.normals;
+    Intersection isect;
+    isect.t                 = hit.t;
+    isect.face_index        = primitives[i];
+    isect.barycentric_coord = Vector3f(hit.u, hit.v, 1.0f - hit.u - hit.v);
+    isect.normal            = Vector3f(n[0][i], n[1][i], n[2][i]);
+    return isect;
+}
+
+// 缓存文件的开头，之后依次是所有节点和所有图元索引。节点和索引按内存中的格式直接写出，
+// 因此还记录了它们的大小，其他平台或版本写出的文件会被拒绝。
+struct CacheHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t node_size;
+    std::uint32_t index_size;
+    std::uint32_t max_leaf_size;
+    std::uint64_t mesh_hash;
+    std::uint64_t n_faces;
+    std::uint64_t n_nodes;
+    float sah_cost;
+};
+
+constexpr char cache_magic[8]        = {'D', 'B', 'V', 'H', 'C', 'A', 'C', 'H'};
+constexpr std::uint32_t cache_version = 1;
+
+// Check that nodes and primitives read from a file form a tree that traversal can walk
+// safely: every node except the root has exactly one parent stored before it, leaves cover
+// valid ranges and the depth fits the fixed traversal stacks. Return the depth of the tree,
+// or 0 if it is invalid.
+size_t validated_depth(const vector<BVHNode>& nodes, const vector<size_t>& primitives,
+                       size_t max_leaf_size)
+{
+    const size_t n_faces = primitives.size();
+    vector<bool> seen(n_faces, false);
+    for (size_t primitive : primitives) {
+        if (primitive >= n_faces || seen[primitive]) {
+            return 0;
+        }
+        seen[primitive] = true;
+    }
+    vector<size_t> levels(nodes.size(), 0);
+    vector<bool> has_parent(nodes.size(), false);
+    levels[0]         = 1;
+    size_t depth      = 1;
+    size_t leaf_faces = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const BVHNode& node = nodes[i];
+        if ((i > 0 && !has_parent[i]) || levels[i] > max_depth) {
+            return 0;
+        }
+        depth = std::max(depth, levels[i]);
+        if (node.n_primitives > 0) {
+            if (node.n_primitives > max_leaf_size ||
+                static_cast<size_t>(node.offset) + node.n_primitives > n_faces) {
+                return 0;
+            }
+            leaf_faces += node.n_primitives;
+            continue;
+        }
+        if (node.axis > 2 || i + 1 >= nodes.size() || node.offset <= i + 1 ||
+            node.offset >= nodes.size()) {
+            return 0;
+        }
+        for (size_t child : {i + 1, static_cast<size_t>(node.offset)}) {
+            // a second parent would turn the tree into a DAG
+            if (has_parent[child]) {
+                return 0;
+            }
+            levels[child]     = levels[i] + 1;
+            has_parent[child] = true;
+        }
+    }
+    return leaf_faces == n_faces ? depth : 0;
+}
+
+#if DANDELION_BVH_WIDTH > 2
+// 模型坐标系下的射线，测试宽节点时需要的量都预先算好
+struct WideRay
+{
+    std::array<float, 3> origin;
+    std::array<float, 3> inv_dir;
+    // rows of WideBVHNode::bounds where the ray enters and leaves the slab of each axis
+    std::array<int, 3> near_row;
+    std::array<int, 3> far_row;
+};
+
+// Test the boxes of all children with the slab test of AABB::intersect, and return a mask
+// whose i-th bit is set if the ray hits the i-th child within [0, t_max]. The entering t of
+// every child is written into t_enter.
+inline int intersect_children(const WideBVHNode& node, const WideRay& ray, float t_max,
+                              float* t_enter)
+{
+    int mask = 0;
+    if constexpr (bvh_width % FloatLanes::width == 0) {
+        for (size_t i = 0; i < bvh_width; i += FloatLanes::width) {
+            FloatLanes enter = FloatLanes::broadcast(0.0f);
+            FloatLanes exit  = FloatLanes::broadcast(t_max);
+            for (int axis = 0; axis < 3; axis++) {
+                const FloatLanes origin  = FloatLanes::broadcast(ray.origin[axis]);
+                const FloatLanes inv_dir = FloatLanes::broadcast(ray.inv_dir[axis]);
+                const FloatLanes near    = FloatLanes::load(node.bounds[ray.near_row[axis]] + i);
+                const FloatLanes far     = FloatLanes::load(node.bounds[ray.far_row[axis]] + i);
+                enter                    = max(enter, (near - origin) * inv_dir);
+                exit                     = min(exit, (far - origin) * inv_dir);
+            }
+            enter.store(t_enter + i);
+            mask |= (exit - enter).non_negative_mask() << i;
+        }
+    } else {
+        for (size_t i = 0; i < bvh_width; i++) {
+            float enter = 0.0f;
+            float exit  = t_max;
+            for (int axis = 0; axis < 3; axis++) {
+                const float near = node.bounds[ray.near_row[axis]][i] - ray.origin[axis];
+                const float far  = node.bounds[ray.far_row[axis]][i] - ray.origin[axis];
+                enter            = std::max(enter, near * ray.inv_dir[axis]);
+                exit             = std::min(exit, far * ray.inv_dir[axis]);
+            }
+            t_enter[i] = enter;
+            mask |= (enter <= exit ? 1 : 0) << i;
+        }
+    }
+    return mask;
+}
+#endif
+
+} // namespace
+
+static_assert(std::is_trivially_destructible_v<BVHNode>,
+              "rebuilding relies on clearing the nodes in constant time");
+
+BVHNode::BVHNode() : offset(0), n_primitives(0), axis(0)
+{
+}
+
+std::string BVHStats::to_json() const
+{
+    std::string histogram;
+    for (size_t i = 0; i < leaf_size_histogram.size(); i++) {
+        histogram += fmt::format("{}{}", i > 0 ? ", " : "", leaf_size_histogram[i]);
+    }
+    return fmt::format("{{\"nodes\": {}, \"leaves\": {}, \"sah_cost\": {}, \"overlap\": {}, "
+                       "\"max_depth\": {}, \"average_depth\": {}, \"leaf_size_histogram\": [{}], "
+                       "\"build_time\": {}, \"memory\": {}}}",
+                       n_nodes, n_leaves, sah_cost, overlap, max_depth, average_depth, histogram,
+                       build_time, memory);
+}
+
+TraversalCounters BVH::traversal_counters;
+
+void TraversalCounters::reset()
+{
+    rays.store(0, std::memory_order_relaxed);
+    nodes_visited.store(0, std::memory_order_relaxed);
+    triangles_tested.store(0, std::memory_order_relaxed);
+}
+
+std::string TraversalCounters::to_json() const
+{
+    const std::uint64_t n_rays      = rays.load(std::memory_order_relaxed);
+    const std::uint64_t n_nodes     = nodes_visited.load(std::memory_order_relaxed);
+    const std::uint64_t n_triangles = triangles_tested.load(std::memory_order_relaxed);
+    const double per_ray            = n_rays > 0 ? 1.0 / static_cast<double>(n_rays) : 0.0;
+    return fmt::format("{{\"rays\": {}, \"nodes_visited\": {}, \"triangles_tested\": {}, "
+                       "\"nodes_per_ray\": {}, \"triangles_per_ray\": {}}}",
+                       n_rays, n_nodes, n_triangles, static_cast<double>(n_nodes) * per_ray,
+                       static_cast<double>(n_triangles) * per_ray);
+}
+
+BVH::BVH(const GL::Mesh& mesh)
+    : mesh(mesh), max_leaf_size(4), parallel_build(true), sah_cost(0.0f), depth(0),
+      built_sah_cost(0.0f)
 {
 }
 
 // 建立bvh，将需要建立BVH的图元索引初始化
 void BVH::build()
 {
+    const auto begin_time = steady_clock::now();
+    // Nodes and faces are trivially destructible, so clearing the buffers is O(1) and keeps
+    // their capacity for the new tree.
+    nodes.clear();
+#if DANDELION_BVH_WIDTH > 2
+    wide_nodes.clear();
+#endif
+    primitives.clear();
+    sah_cost       = 0.0f;
+    built_sah_cost = 0.0f;
+    depth          = 0;
     if (mesh.faces.count() == 0) {
-        root = nullptr;
+        triangles = TriangleStore();
+        release_build_memory();
+        stats = BVHStats();
+        update_stats();
         return;
     }
 
-    primitives.resize(mesh.faces.count());
-    for (size_t i = 0; i < mesh.faces.count(); i++) primitives[i] = i;
+    const size_t n_faces = mesh.faces.count();
+    pool                 = parallel_build ? &RenderEngine::thread_pool() : nullptr;
+    primitives.resize(n_faces);
+    primitive_boxes.resize(n_faces);
+    primitive_centroids.resize(n_faces);
+    for_each_chunk(0, n_faces, [this](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            primitives[i]          = i;
+            primitive_boxes[i]     = get_aabb(mesh, i);
+            primitive_centroids[i] = primitive_boxes[i].centroid();
+        }
+    });
 
-    root = recursively_build(primitives);
-    return;
+    Subtree tree;
+    // Build into the storage of the previous tree, which is already large enough when the
+    // same mesh is rebuilt. A binary tree with at least one face per leaf has no more than
+    // 2n - 1 nodes. Subtrees forked into the thread pool are built into arrays of their own,
+    // which are allocated once per build at that bound and freed after being spliced.
+    tree.nodes.swap(nodes);
+    tree.nodes.reserve(2 * n_faces - 1);
+    recursively_build(0, n_faces, 1, tree);
+    nodes.swap(tree.nodes);
+    store_triangles();
+    depth = tree.depth;
+    // the SAH cost was accumulated as absolute areas, normalize it by the root's area
+    const float root_area = nodes.front().aabb.surface_area();
+    sah_cost              = root_area > 0.0f ? tree.sah_cost / root_area : 0.0f;
+    built_sah_cost        = sah_cost;
+#if DANDELION_BVH_WIDTH > 2
+    wide_nodes.clear();
+    wide_nodes.reserve(nodes.size() / (bvh_width - 1) + 1);
+    collapse(0);
+#endif
+    pool = nullptr;
+    update_stats();
+    const duration build_duration = steady_clock::now() - begin_time;
+    stats.build_time              = build_duration.count();
 }
-// 删除bvh
-void BVH::recursively_delete(BVHNode* node)
+// 归还只在构建时需要的内存，树本身不变
+void BVH::release_build_memory()
 {
-    if (node == nullptr)
-        return;
-    recursively_delete(node->left);
-    recursively_delete(node->right);
-    delete node;
-    node = nullptr;
+    nodes.shrink_to_fit();
+#if DANDELION_BVH_WIDTH > 2
+    wide_nodes.shrink_to_fit();
+#endif
+    primitive_boxes.clear();
+    primitive_boxes.shrink_to_fit();
+    primitive_centroids.clear();
+    primitive_centroids.shrink_to_fit();
+    stats.memory = memory_usage();
+}
+// 按当前的顶点位置更新包围盒，树的结构和面片的顺序都不变
+bool BVH::refit()
+{
+    if (nodes.empty() || primitives.size() != mesh.faces.count()) {
+        return false;
+    }
+    // Children are always stored after their parents, so a reversed sweep visits them first.
+    // The SAH cost is accumulated the same way as in build.
+    float cost = 0.0f;
+    for (size_t i = nodes.size(); i-- > 0;) {
+        BVHNode& node = nodes[i];
+        if (node.n_primitives > 0) {
+            AABB box;
+            for (size_t j = node.offset; j < node.offset + node.n_primitives; j++) {
+                expand(box, get_aabb(mesh, primitives[j]));
+            }
+            node.aabb = box;
+            cost += box.surface_area() * intersection_cost * static_cast<float>(node.n_primitives);
+        } else {
+            node.aabb = nodes[i + 1].aabb;
+            expand(node.aabb, nodes[node.offset].aabb);
+            cost += node.aabb.surface_area() * traversal_cost;
+        }
+    }
+    store_triangles();
+    const float root_area = nodes.front().aabb.surface_area();
+    sah_cost              = root_area > 0.0f ? cost / root_area : 0.0f;
+#if DANDELION_BVH_WIDTH > 2
+    wide_nodes.clear();
+    collapse(0);
+#endif
+    update_stats();
+    return sah_cost <= max_refit_cost_ratio * built_sah_cost;
+}
+// 优先从磁盘缓存读取，失败时重新构建并更新缓存
+bool BVH::load_or_build()
+{
+    if (mesh.faces.count() < cache_threshold) {
+        build();
+        return false;
+    }
+    const std::uint64_t hash = mesh_hash(mesh);
+    const std::string path =
+        (fs::path(cache_directory) / fmt::format("{:016x}.bvh", hash)).string();
+    if (load(path, hash)) {
+        return true;
+    }
+    build();
+    std::error_code error;
+    fs::create_directories(cache_directory, error);
+    save(path, hash);
+    return false;
+}
+
+bool BVH::save(const std::string& path) const
+{
+    return save(path, mesh_hash(mesh));
+}
+
+bool BVH::save(const std::string& path, std::uint64_t hash) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version       = cache_version;
+    header.node_size     = sizeof(BVHNode);
+    header.index_size    = sizeof(size_t);
+    header.max_leaf_size = static_cast<std::uint32_t>(max_leaf_size);
+    header.mesh_hash     = hash;
+    header.n_faces       = primitives.size();
+    header.n_nodes       = nodes.size();
+    header.sah_cost      = built_sah_cost;
+    const std::string temporary_path =
+        path + "." + std::to_string(reinterpret_cast<std::uintptr_t>(this)) + ".tmp";
+    std::error_code error;
+    {
+        std::ofstream file(temporary_path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(nodes.data()),
+                   static_cast<std::streamsize>(nodes.size() * sizeof(BVHNode)));
+        file.write(reinterpret_cast<const char*>(primitives.data()),
+                   static_cast<std::streamsize>(primitives.size() * sizeof(size_t)));
+        if (!file) {
+            file.close();
+            fs::remove(temporary_path, error);
+            return false;
+        }
+    }
+    fs::rename(temporary_path, path, error);
+    if (error) {
+        fs::remove(temporary_path, error);
+        return false;
+    }
+    return true;
+}
+
+bool BVH::load(const std::string& path)
+{
+    return load(path, mesh_hash(mesh));
+}
+
+bool BVH::load(const std::string& path, std::uint64_t hash)
+{
+    const auto begin_time = steady_clock::now();
+    std::ifstream file(path, std::ios::binary);
+    CacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+    const size_t n_faces = mesh.faces.count();
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        header.version != cache_version || header.node_size != sizeof(BVHNode) ||
+        header.index_size != sizeof(size_t) || header.max_leaf_size != max_leaf_size ||
+        header.mesh_hash != hash || n_faces == 0 || header.n_faces != n_faces ||
+        header.n_nodes == 0 || header.n_nodes > 2 * n_faces - 1) {
+        return false;
+    }
+    vector<BVHNode> loaded_nodes(header.n_nodes);
+    vector<size_t> loaded_primitives(n_faces);
+    file.read(reinterpret_cast<char*>(loaded_nodes.data()),
+              static_cast<std::streamsize>(loaded_nodes.size() * sizeof(BVHNode)));
+    file.read(reinterpret_cast<char*>(loaded_primitives.data()),
+              static_cast<std::streamsize>(loaded_primitives.size() * sizeof(size_t)));
+    if (!file || file.peek() != std::ifstream::traits_type::eof()) {
+        return false;
+    }
+    const size_t loaded_depth = validated_depth(loaded_nodes, loaded_primitives, max_leaf_size);
+    if (loaded_depth == 0) {
+        return false;
+    }
+
+    nodes          = std::move(loaded_nodes);
+    primitives     = std::move(loaded_primitives);
+    depth          = loaded_depth;
+    sah_cost       = header.sah_cost;
+    built_sah_cost = header.sah_cost;
+    pool           = parallel_build ? &RenderEngine::thread_pool() : nullptr;
+    store_triangles();
+    pool = nullptr;
+#if DANDELION_BVH_WIDTH > 2
+    wide_nodes.clear();
+    wide_nodes.reserve(nodes.size() / (bvh_width - 1) + 1);
+    collapse(0);
+#endif
+    update_stats();
+    const duration load_duration = steady_clock::now() - begin_time;
+    stats.build_time             = load_duration.count();
+    return true;
+}
+
+std::uint64_t BVH::mesh_hash(const GL::Mesh& mesh)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    const auto mix     = [&hash](const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    const std::uint64_t n_vertices = mesh.vertices.data.size();
+    const std::uint64_t n_indices  = mesh.faces.data.size();
+    mix(&n_vertices, sizeof(n_vertices));
+    mix(mesh.vertices.data.data(), mesh.vertices.data.size() * sizeof(float));
+    mix(&n_indices, sizeof(n_indices));
+    mix(mesh.faces.data.data(), mesh.faces.data.size() * sizeof(mesh.faces.data[0]));
+    return hash;
 }
 // 统计BVH树建立的节点个数
-size_t BVH::count_nodes(BVHNode* node)
+size_t BVH::count_nodes() const
 {
-    if (node == nullptr)
-        return 0;
-    else
-        return count_nodes(node->left) + count_nodes(node->right) + 1;
+    return nodes.size();
+}
+
+size_t BVH::memory_usage() const
+{
+    size_t memory = nodes.capacity() * sizeof(BVHNode) + primitives.capacity() * sizeof(size_t) +
+                    primitive_boxes.capacity() * sizeof(AABB) +
+                    primitive_centroids.capacity() * sizeof(Vector3f);
+#if DANDELION_BVH_WIDTH > 2
+    memory += wide_nodes.capacity() * sizeof(WideBVHNode);
+#endif
+    for (const auto& coordinates : triangles.vertices) {
+        memory += coordinates.capacity() * sizeof(float);
+    }
+    for (const auto& coordinates : triangles.normals) {
+        memory += coordinates.capacity() * sizeof(float);
+    }
+    return memory;
+}
+// 遍历一遍所有节点，统计深度、叶节点大小和子节点的重叠程度
+void BVH::update_stats()
+{
+    stats.n_nodes       = nodes.size();
+    stats.n_leaves      = 0;
+    stats.sah_cost      = sah_cost;
+    stats.overlap       = 0.0f;
+    stats.max_depth     = 0;
+    stats.average_depth = 0.0f;
+    stats.leaf_size_histogram.clear();
+    stats.memory = memory_usage();
+    if (nodes.empty()) {
+        return;
+    }
+    // parents are stored before their children, so levels can be filled in one pass
+    vector<size_t> levels(nodes.size(), 1);
+    size_t depth_sum   = 0;
+    float overlap_area = 0.0f;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const BVHNode& node = nodes[i];
+        stats.max_depth     = std::max(stats.max_depth, levels[i]);
+        if (node.n_primitives > 0) {
+            ++stats.n_leaves;
+            depth_sum += levels[i];
+            if (stats.leaf_size_histogram.size() <= node.n_primitives) {
+                stats.leaf_size_histogram.resize(node.n_primitives + 1, 0);
+            }
+            ++stats.leaf_size_histogram[node.n_primitives];
+            continue;
+        }
+        levels[i + 1]       = levels[i] + 1;
+        levels[node.offset] = levels[i] + 1;
+        const AABB& left    = nodes[i + 1].aabb;
+        const AABB& right   = nodes[node.offset].aabb;
+        AABB overlap;
+        overlap.p_min = left.p_min.cwiseMax(right.p_min);
+        overlap.p_max = left.p_max.cwiseMin(right.p_max);
+        if ((overlap.p_min.array() <= overlap.p_max.array()).all()) {
+            overlap_area += overlap.surface_area();
+        }
+    }
+    const float root_area = nodes.front().aabb.surface_area();
+    stats.overlap         = root_area > 0.0f ? overlap_area / root_area : 0.0f;
+    stats.average_depth   = static_cast<float>(depth_sum) / static_cast<float>(stats.n_leaves);
+}
+// 把 [begin, end) 分成若干段，面片足够多并且允许并行构建时由线程池并行处理
+template<typename F>
+size_t BVH::for_each_chunk(size_t begin, size_t end, F&& f)
+{
+    const size_t count = end - begin;
+    if (pool == nullptr || count < parallel_threshold) {
+        f(0, begin, end);
+        return 1;
+    }
+    const size_t n_chunks = std::min(max_chunks, count / (parallel_threshold / 4));
+    pool->parallel_for(n_chunks, [&](size_t chunk) {
+        f(chunk, begin + count * chunk / n_chunks, begin + count * (chunk + 1) / n_chunks);
+    });
+    return n_chunks;
 }
-// 递归建立BVH
-BVHNode* BVH::recursively_build(vector<size_t> faces_idx)
+// 按叶节点的顺序取出所有三角形，预先算好法向量
+void BVH::store_triangles()
 {
-    BVHNode* node = new BVHNode();
+    const size_t n_faces = primitives.size();
+    for (auto& coordinates : triangles.vertices) {
+        coordinates.assign(n_faces + TriangleStore::padding, 0.0f);
+    }
+    for (auto& coordinates : triangles.normals) {
+        coordinates.assign(n_faces + TriangleStore::padding, 0.0f);
+    }
+    for_each_chunk(0, n_faces, [this](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const std::array<size_t, 3> face = mesh.face(primitives[i]);
+            std::array<Vector3f, 3> v;
+            for (int k = 0; k < 3; k++) {
+                v[k] = mesh.vertex(face[k]);
+                for (int axis = 0; axis < 3; axis++) {
+                    triangles.vertices[3 * k + axis][i] = v[k][axis];
+                }
+            }
+            const Vector3f normal = (v[1] - v[0]).cross(v[2] - v[0]).normalized();
+            for (int axis = 0; axis < 3; axis++) {
+                triangles.normals[axis][i] = normal[axis];
+            }
+        }
+    });
+}
+// 递归建立BVH：在面片中心的包围盒内分桶，用 SAH 选择代价最小的划分平面
+size_t BVH::recursively_build(size_t begin, size_t end, size_t node_depth, Subtree& output)
+{
+    // children are appended while building, so the node is referred by index
+    const size_t index = output.nodes.size();
+    output.nodes.emplace_back();
+    output.depth = std::max(output.depth, node_depth);
 
-    AABB aabb;
-    for (size_t i = 0; i < faces_idx.size(); i++) {
-        aabb = union_AABB(aabb, get_aabb(mesh, faces_idx[i]));
-    }
-    // if faces_idx.size()==1: return node;
-    // if faces_idx.size()==2: recursively_build() & union_AABB(node->left->aabb,
-    // node->right->aabb); else:
-    // choose the longest dimension among x,y,z
-    // devide the primitives into two along the longest dimension
-    // recursively_build() & union_AABB(node->left->aabb, node->right->aabb)
-    return node;
-}
-// 使用BVH求交
+    // Compute the bounds and fill the bins of every chunk separately, then merge them. Large
+    // nodes near the root are processed by the thread pool this way.
+    auto compute_bounds = [&](AABB& output_box, AABB& output_centroids, size_t first,
+                              size_t last) {
+        AABB chunk_box, chunk_centroids;
+        for (size_t i = first; i < last; i++) {
+            expand(chunk_box, primitive_boxes[primitives[i]]);
+            expand(chunk_centroids, primitive_centroids[primitives[i]]);
+        }
+        output_box       = chunk_box;
+        output_centroids = chunk_centroids;
+    };
+    AABB box, centroid_bounds;
+    size_t n_chunks = 1;
+    if (pool == nullptr || end - begin < parallel_threshold) {
+        compute_bounds(box, centroid_bounds, begin, end);
+    } else {
+        std::array<AABB, max_chunks> chunk_boxes, chunk_centroids;
+        n_chunks = for_each_chunk(begin, end, [&](size_t chunk, size_t first, size_t last) {
+            compute_bounds(chunk_boxes[chunk], chunk_centroids[chunk], first, last);
+        });
+        for (size_t chunk = 0; chunk < n_chunks; chunk++) {
+            expand(box, chunk_boxes[chunk]);
+            expand(centroid_bounds, chunk_centroids[chunk]);
+        }
+    }
+    output.nodes[index].aabb  = box;
+    const size_t count        = end - begin;
+    const size_t n_leaf_faces = std::min<size_t>(max_leaf_size, UINT16_MAX);
+    const float area          = box.surface_area();
+    auto make_leaf            = [&]() {
+        output.nodes[index].offset       = static_cast<std::uint32_t>(begin);
+        output.nodes[index].n_primitives = static_cast<std::uint16_t>(count);
+        output.sah_cost += area * intersection_cost * static_cast<float>(count);
+        return index;
+    };
+    if (count == 1 || (node_depth >= max_sah_depth && count <= n_leaf_faces)) {
+        return make_leaf();
+    }
+
+    // Bin the faces on all three axes in one pass, then evaluate the n_bins - 1 planes
+    // between bins on every axis. Costs are not divided by the area of this node since
+    // only their relative order matters here.
+    const Vector3f extent = centroid_bounds.diagonal();
+    const Vector3f scale  = Vector3f::Constant(static_cast<float>(n_bins)).cwiseQuotient(extent);
+    auto bin_index        = [&](size_t face, int axis) {
+        const float offset = primitive_centroids[face][axis] - centroid_bounds.p_min[axis];
+        return std::min(n_bins - 1, static_cast<size_t>(offset * scale[axis]));
+    };
+    using AxisBins = std::array<std::array<Bin, n_bins>, 3>;
+    AxisBins bins;
+    auto fill_bins = [&](AxisBins& output_bins, size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            const size_t face = primitives[i];
+            for (int axis = 0; axis < 3; axis++) {
+                if (extent[axis] > 0.0f) {
+                    Bin& bin = output_bins[axis][bin_index(face, axis)];
+                    expand(bin.aabb, primitive_boxes[face]);
+                    ++bin.count;
+                }
+            }
+        }
+    };
+    // bins of separate chunks are only allocated for the few nodes built in parallel
+    std::vector<AxisBins> chunk_bins;
+    if (node_depth >= max_sah_depth) {
+        n_chunks = 0;
+    } else if (n_chunks == 1) {
+        fill_bins(bins, begin, end);
+        n_chunks = 0;
+    } else {
+        chunk_bins.resize(n_chunks);
+        n_chunks = for_each_chunk(begin, end, [&](size_t chunk, size_t first, size_t last) {
+            fill_bins(chunk_bins[chunk], first, last);
+        });
+    }
+    for (size_t chunk = 0; chunk < n_chunks; chunk++) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (size_t b = 0; b < n_bins; b++) {
+                expand(bins[axis][b].aabb, chunk_bins[chunk][axis][b].aabb);
+                bins[axis][b].count += chunk_bins[chunk][axis][b].count;
+            }
+        }
+    }
+    float best_cost   = std::numeric_limits<float>::infinity();
+    int best_axis     = -1;
+    size_t best_split = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (!(extent[axis] > 0.0f)) {
+            continue;
+        }
+        // sweep from the right to get the area and count on the right side of each plane
+        std::array<float, n_bins> right_area;
+        std::array<size_t, n_bins> right_count;
+        AABB right_box;
+        size_t n_right = 0;
+        for (size_t b = n_bins - 1; b > 0; b--) {
+            expand(right_box, bins[axis][b].aabb);
+            n_right += bins[axis][b].count;
+            right_area[b]  = right_box.surface_area();
+            right_count[b] = n_right;
+        }
+        AABB left_box;
+        size_t n_left = 0;
+        for (size_t b = 1; b < n_bins; b++) {
+            expand(left_box, bins[axis][b - 1].aabb);
+            n_left += bins[axis][b - 1].count;
+            if (n_left == 0 || right_count[b] == 0) {
+                continue;
+            }
+            const float cost = left_box.surface_area() * static_cast<float>(n_left) +
+                               right_area[b] * static_cast<float>(right_count[b]);
+            if (cost < best_cost) {
+                best_cost  = cost;
+                best_axis  = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    size_t middle = begin + count / 2;
+    if (best_axis >= 0) {
+        const float leaf_cost  = intersection_cost * static_cast<float>(count);
+        const float split_cost = traversal_cost + intersection_cost * best_cost / area;
+        if (count <= n_leaf_faces && leaf_cost <= split_cost) {
+            return make_leaf();
+        }
+        const auto split =
+            std::partition(primitives.begin() + static_cast<std::ptrdiff_t>(begin),
+                           primitives.begin() + static_cast<std::ptrdiff_t>(end),
+                           [&](size_t face) { return bin_index(face, best_axis) < best_split; });
+        middle                   = static_cast<size_t>(split - primitives.begin());
+        output.nodes[index].axis = static_cast<std::uint8_t>(best_axis);
+    } else if (count <= n_leaf_faces) {
+        // all centroids coincide, no plane can separate them
+        return make_leaf();
+    } else {
+        // split evenly along the longest axis of the centroids
+        const int axis = centroid_bounds.max_extent();
+        std::nth_element(primitives.begin() + static_cast<std::ptrdiff_t>(begin),
+                         primitives.begin() + static_cast<std::ptrdiff_t>(middle),
+                         primitives.begin() + static_cast<std::ptrdiff_t>(end),
+                         [&](size_t a, size_t b) {
+                             return primitive_centroids[a][axis] < primitive_centroids[b][axis];
+                         });
+        output.nodes[index].axis = static_cast<std::uint8_t>(axis);
+    }
+    // Binning always produces two non-empty sides, but fall back to an even split in case
+    // rounding disagrees.
+    if (middle == begin || middle == end) {
+        middle = begin + count / 2;
+    }
+    output.sah_cost += area * traversal_cost;
+    // The left child immediately follows its parent in depth-first order. Large ranges fork
+    // the left subtree into the thread pool and build it into a separate array, which is
+    // spliced after the parent once both subtrees are done.
+    if (pool == nullptr || count < parallel_threshold) {
+        recursively_build(begin, middle, node_depth + 1, output);
+        const size_t right         = recursively_build(middle, end, node_depth + 1, output);
+        output.nodes[index].offset = static_cast<std::uint32_t>(right);
+        return index;
+    }
+    // reserve the node bound of each side, so that neither array grows while it is built
+    Subtree left, right;
+    left.nodes.reserve(2 * (middle - begin) - 1);
+    right.nodes.reserve(2 * (end - middle) - 1);
+    ThreadPool::TaskGroup group;
+    pool->submit(group, [&]() { recursively_build(begin, middle, node_depth + 1, left); });
+    recursively_build(middle, end, node_depth + 1, right);
+    pool->wait(group);
+    splice(left, output);
+    output.nodes[index].offset = static_cast<std::uint32_t>(output.nodes.size());
+    splice(right, output);
+    return index;
+}
+// 把独立构建的子树接到 output 末尾：内部节点的子节点序号加上偏移，叶节点的面片范围不变
+void BVH::splice(Subtree& subtree, Subtree& output)
+{
+    const size_t base = output.nodes.size();
+    for (BVHNode& node : subtree.nodes) {
+        if (node.n_primitives == 0) {
+            node.offset += static_cast<std::uint32_t>(base);
+        }
+    }
+    output.nodes.insert(output.nodes.end(), subtree.nodes.begin(), subtree.nodes.end());
+    output.sah_cost += subtree.sah_cost;
+    output.depth = std::max(output.depth, subtree.depth);
+}
+// 初始化射线包，并在射线方向一致时计算用于区间剔除的取值范围
+void RayPacket::set(const Ray* rays, size_t count, const float* t_max_values)
+{
+    n        = count;
+    coherent = true;
+    for (size_t i = 0; i < size; i++) {
+        // unused lanes repeat the last ray, so they do not widen the intervals
+        const Ray& ray = rays[std::min(i, count - 1)];
+        for (int axis = 0; axis < 3; axis++) {
+            origin[axis][i]  = ray.origin[axis];
+            inv_dir[axis][i] = 1.0f / ray.direction[axis];
+            // rays parallel to a slab would turn the interval arithmetic into NaN
+            coherent = coherent && std::isfinite(inv_dir[axis][i]) &&
+                       (inv_dir[axis][i] < 0.0f) == (inv_dir[axis][0] < 0.0f);
+        }
+        t_max[i] = t_max_values[std::min(i, count - 1)];
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        origin_min[axis]  = *std::min_element(origin[axis], origin[axis] + size);
+        origin_max[axis]  = *std::max_element(origin[axis], origin[axis] + size);
+        inv_dir_min[axis] = *std::min_element(inv_dir[axis], inv_dir[axis] + size);
+        inv_dir_max[axis] = *std::max_element(inv_dir[axis], inv_dir[axis] + size);
+    }
+}
+// 先用区间算术剔除整个射线包都不会相交的包围盒，再逐条射线做 slab test
+int RayPacket::intersect(const AABB& box, int active) const
+{
+    if (coherent) {
+        // Bound the entering t of all rays from below and their exiting t from above. The
+        // box is missed by every ray if the lower bound is greater than the upper bound.
+        float enter = 0.0f;
+        float exit  = *std::max_element(t_max, t_max + size);
+        for (int axis = 0; axis < 3; axis++) {
+            const bool negative = inv_dir[axis][0] < 0.0f;
+            const float near    = negative ? box.p_max[axis] : box.p_min[axis];
+            const float far     = negative ? box.p_min[axis] : box.p_max[axis];
+            const std::array<float, 4> t_near = {
+                (near - origin_max[axis]) * inv_dir_min[axis],
+                (near - origin_max[axis]) * inv_dir_max[axis],
+                (near - origin_min[axis]) * inv_dir_min[axis],
+                (near - origin_min[axis]) * inv_dir_max[axis]};
+            const std::array<float, 4> t_far = {
+                (far - origin_max[axis]) * inv_dir_min[axis],
+                (far - origin_max[axis]) * inv_dir_max[axis],
+                (far - origin_min[axis]) * inv_dir_min[axis],
+                (far - origin_min[axis]) * inv_dir_max[axis]};
+            enter = std::max(enter, *std::min_element(t_near.begin(), t_near.end()));
+            exit  = std::min(exit, *std::max_element(t_far.begin(), t_far.end()));
+        }
+        if (enter > exit) {
+            return 0;
+        }
+    }
+    int mask = 0;
+    for (size_t i = 0; i < size; i += FloatLanes::width) {
+        FloatLanes enter = FloatLanes::broadcast(0.0f);
+        FloatLanes exit  = FloatLanes::load(t_max + i);
+        for (int axis = 0; axis < 3; axis++) {
+            const FloatLanes o       = FloatLanes::load(origin[axis] + i);
+            const FloatLanes inv     = FloatLanes::load(inv_dir[axis] + i);
+            const FloatLanes t_lower = (FloatLanes::broadcast(box.p_min[axis]) - o) * inv;
+            const FloatLanes t_upper = (FloatLanes::broadcast(box.p_max[axis]) - o) * inv;
+            enter                    = max(enter, min(t_lower, t_upper));
+            exit                     = min(exit, max(t_lower, t_upper));
+        }
+        mask |= (exit - enter).non_negative_mask() << i;
+    }
+    return mask & active;
+}
+// 使用BVH求交：把射线变换到模型坐标系下求交，再把结果变换回世界坐标系
 optional<Intersection> BVH::intersect(const Ray& ray, [[maybe_unused]] const GL::Mesh& mesh,
-                                      const Eigen::Matrix4f obj_model)
+                                      const Eigen::Matrix4f obj_model) const
 {
-    model = obj_model;
-    optional<Intersection> isect;
-    if (!root) {
-        isect = std::nullopt;
-        return isect;
+    if (nodes.empty()) {
+        return std::nullopt;
+    }
+    const Eigen::Matrix4f inv_model = obj_model.inverse();
+    Ray model_ray;
+    model_ray.origin = (inv_model * ray.origin.homogeneous()).head<3>();
+    // The direction is normalized in the model coordinate system. If the model is scaled,
+    // t changes by the length of the transformed direction.
+    const Vector3f direction = inv_model.topLeftCorner<3, 3>() * ray.direction;
+    const float length       = direction.norm();
+    model_ray.direction      = direction / length;
+
+#if DANDELION_BVH_WIDTH > 2
+    optional<Intersection> isect = wide_intersect(model_ray);
+#else
+    optional<Intersection> isect = ray_node_intersect(0, model_ray);
+#endif
+    if (isect.has_value()) {
+        isect->t /= length;
+        isect->normal = (inv_model.topLeftCorner<3, 3>().transpose() * isect->normal).normalized();
     }
-    isect = ray_node_intersect(root, ray);
     return isect;
 }
-// 发射的射线与当前节点求交，并递归获取最终的求交结果
-optional<Intersection> BVH::ray_node_intersect(BVHNode* node, const Ray& ray) const
-{
-    // these lines below are just for compiling and can be deleted
-    (void)ray;
-    (void)node;
-    // these lines above are just for compiling and can be deleted
-
-    optional<Intersection> isect;
-    // The node intersection is performed in the model coordinate system.
-    // Therefore, the ray needs to be transformed into the model coordinate system.
-    // The intersection attributes returned are all in the model coordinate system.
-    // Therefore, They are need to be converted to the world coordinate system.    
-    // If the model shrinks, the value of t will also change.
-    // The change of t can be solved by intersection point changing simultaneously
-            
-    return isect;
+// 发射的射线与当前节点求交，遍历它的子树获取最近的交点
+optional<Intersection> BVH::ray_node_intersect(size_t node, const Ray& ray) const
+{
+    const Vector3f inv_dir = ray.direction.cwiseInverse();
+    const std::array<int, 3> dir_is_neg = {ray.direction.x() < 0.0f, ray.direction.y() < 0.0f,
+                                           ray.direction.z() < 0.0f};
+    const ShearedRay sheared = shear(ray);
+    TriangleHit hit;
+    bool found = false;
+    // every level of the tree pushes at most one node
+    std::array<size_t, max_depth> stack;
+    size_t stack_size = 0;
+    size_t current    = node;
+    size_t n_visited  = 0;
+    size_t n_tested   = 0;
+    while (true) {
+        const BVHNode& n = nodes[current];
+        ++n_visited;
+        if (n.aabb.intersect(ray, inv_dir, dir_is_neg, hit.t)) {
+            if (n.n_primitives == 0) {
+                // visit the child nearer along the ray first and defer the other one
+                const size_t left  = current + 1;
+                const size_t right = n.offset;
+                if (dir_is_neg[n.axis]) {
+                    stack[stack_size++] = left;
+                    current             = right;
+                } else {
+                    stack[stack_size++] = right;
+                    current             = left;
+                }
+                continue;
+            }
+            found |= intersect_leaf(triangles, n.offset, n.n_primitives, sheared, hit);
+            n_tested += n.n_primitives;
+        }
+        if (stack_size == 0) {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+    traversal_counters.record(0, n_visited, n_tested);
+    if (!found) {
+        return std::nullopt;
+    }
+    return make_intersection(triangles, primitives, hit);
+}
+// 按射线包批量求交：每个包在模型坐标系下一起遍历二叉树，结果再变换回世界坐标系
+size_t BVH::intersect_n(const Ray* rays, size_t n, const Eigen::Matrix4f& obj_model,
+                        Intersection* results) const
+{
+    if (nodes.empty()) {
+        return 0;
+    }
+    const Eigen::Matrix4f inv_model = obj_model.inverse();
+    size_t n_updated                = 0;
+    for (size_t begin = 0; begin < n; begin += RayPacket::size) {
+        const size_t count = std::min(RayPacket::size, n - begin);
+        std::array<Ray, RayPacket::size> model_rays;
+        std::array<ShearedRay, RayPacket::size> sheared;
+        std::array<float, RayPacket::size> lengths;
+        std::array<float, RayPacket::size> t_max;
+        for (size_t i = 0; i < count; i++) {
+            const Ray& ray          = rays[begin + i];
+            model_rays[i].origin    = (inv_model * ray.origin.homogeneous()).head<3>();
+            const Vector3f dir      = inv_model.topLeftCorner<3, 3>() * ray.direction;
+            lengths[i]              = dir.norm();
+            model_rays[i].direction = dir / lengths[i];
+            t_max[i]                = results[begin + i].t * lengths[i];
+            sheared[i]              = shear(model_rays[i]);
+        }
+        RayPacket packet;
+        packet.set(model_rays.data(), count, t_max.data());
+        std::array<TriangleHit, RayPacket::size> hits;
+        std::array<bool, RayPacket::size> found = {};
+        for (size_t i = 0; i < count; i++) {
+            hits[i].t = packet.t_max[i];
+        }
+        size_t n_tested        = 0;
+        const size_t n_visited = traverse_packet(nodes, packet, [&](const BVHNode& leaf, int mask) {
+            for (size_t i = 0; i < count; i++) {
+                n_tested += ((mask >> i) & 1) * leaf.n_primitives;
+                if (((mask >> i) & 1) &&
+                    intersect_leaf(triangles, leaf.offset, leaf.n_primitives, sheared[i],
+                                   hits[i])) {
+                    packet.t_max[i] = hits[i].t;
+                    found[i]        = true;
+                }
+            }
+        });
+        traversal_counters.record(0, n_visited, n_tested);
+        for (size_t i = 0; i < count; i++) {
+            if (!found[i]) {
+                continue;
+            }
+            Intersection isect = make_intersection(triangles, primitives, hits[i]);
+            isect.t /= lengths[i];
+            isect.normal =
+                (inv_model.topLeftCorner<3, 3>().transpose() * isect.normal).normalized();
+            results[begin + i] = isect;
+            ++n_updated;
+        }
+    }
+    return n_updated;
+}
+// 阴影测试：与 ray_node_intersect 的遍历相同，但找到任意一个交点就返回
+bool BVH::occluded(const Ray& ray, const Eigen::Matrix4f& obj_model, float t_max) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+    const Eigen::Matrix4f inv_model = obj_model.inverse();
+    Ray model_ray;
+    model_ray.origin         = (inv_model * ray.origin.homogeneous()).head<3>();
+    const Vector3f direction = inv_model.topLeftCorner<3, 3>() * ray.direction;
+    const float length       = direction.norm();
+    model_ray.direction      = direction / length;
+    t_max *= length;
+
+#if DANDELION_BVH_WIDTH > 2
+    return wide_occluded(model_ray, t_max);
+#else
+    const Vector3f inv_dir = model_ray.direction.cwiseInverse();
+    const std::array<int, 3> dir_is_neg = {model_ray.direction.x() < 0.0f,
+                                           model_ray.direction.y() < 0.0f,
+                                           model_ray.direction.z() < 0.0f};
+    const ShearedRay sheared = shear(model_ray);
+    std::array<size_t, max_depth> stack;
+    size_t stack_size = 0;
+    size_t current    = 0;
+    size_t n_visited  = 0;
+    size_t n_tested   = 0;
+    bool hit          = false;
+    while (true) {
+        const BVHNode& n = nodes[current];
+        ++n_visited;
+        if (n.aabb.intersect(model_ray, inv_dir, dir_is_neg, t_max)) {
+            if (n.n_primitives == 0) {
+                // any hit will do, but the nearer child is still more likely to contain one
+                const size_t left  = current + 1;
+                const size_t right = n.offset;
+                if (dir_is_neg[n.axis]) {
+                    stack[stack_size++] = left;
+                    current             = right;
+                } else {
+                    stack[stack_size++] = right;
+                    current             = left;
+                }
+                continue;
+            }
+            n_tested += n.n_primitives;
+            if (occluded_leaf(triangles, n.offset, n.n_primitives, sheared, t_max)) {
+                hit = true;
+                break;
+            }
+        }
+        if (stack_size == 0) {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+    traversal_counters.record(0, n_visited, n_tested);
+    return hit;
+#endif
+}
+// 多次命中查询：按射线进入包围盒的距离从近到远访问节点，找到的交点先放进一个小顶堆，
+// 比所有待访问节点都近时才交给 callback
+size_t BVH::intersect_all(const Ray& ray, const Eigen::Matrix4f& obj_model, float t_min,
+                          float t_max,
+                          const std::function<bool(const Intersection&)>& callback) const
+{
+    if (nodes.empty() || t_min > t_max) {
+        return 0;
+    }
+    const Eigen::Matrix4f inv_model     = obj_model.inverse();
+    const Eigen::Matrix3f normal_matrix = inv_model.topLeftCorner<3, 3>().transpose();
+    Ray model_ray;
+    model_ray.origin         = (inv_model * ray.origin.homogeneous()).head<3>();
+    const Vector3f direction = inv_model.topLeftCorner<3, 3>() * ray.direction;
+    const float length       = direction.norm();
+    model_ray.direction      = direction / length;
+    t_min *= length;
+    t_max *= length;
+
+    // the wide nodes are not ordered by distance, so this query always walks the binary tree
+    const Vector3f inv_dir   = model_ray.direction.cwiseInverse();
+    const ShearedRay sheared = shear(model_ray);
+    using PendingNode        = std::pair<float, size_t>;
+    vector<PendingNode> pending;
+    vector<TriangleHit> hits;
+    const auto farther_node = [](const PendingNode& a, const PendingNode& b) {
+        return a.first > b.first;
+    };
+    const auto farther_hit = [](const TriangleHit& a, const TriangleHit& b) { return a.t > b.t; };
+    size_t n_visited  = 0;
+    size_t n_tested   = 0;
+    size_t n_reported = 0;
+    // report the hits not farther than t in order, and return false once the callback stops
+    const auto report = [&](float t) {
+        while (!hits.empty() && hits.front().t <= t) {
+            std::pop_heap(hits.begin(), hits.end(), farther_hit);
+            Intersection isect = make_intersection(triangles, primitives, hits.back());
+            hits.pop_back();
+            isect.t /= length;
+            isect.normal = (normal_matrix * isect.normal).normalized();
+            ++n_reported;
+            if (!callback(isect)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    float t_enter = 0.0f;
+    if (entry_distance(nodes[0].aabb, model_ray, inv_dir, t_min, t_max, t_enter)) {
+        pending.emplace_back(t_enter, 0);
+    }
+    bool running = true;
+    while (!pending.empty()) {
+        std::pop_heap(pending.begin(), pending.end(), farther_node);
+        const auto [t_node, current] = pending.back();
+        pending.pop_back();
+        // every node still pending is entered after t_node, so nearer hits are final
+        if (!report(t_node)) {
+            running = false;
+            break;
+        }
+        const BVHNode& n = nodes[current];
+        ++n_visited;
+        if (n.n_primitives == 0) {
+            for (const size_t child : {current + 1, static_cast<size_t>(n.offset)}) {
+                if (entry_distance(nodes[child].aabb, model_ray, inv_dir, t_min, t_max,
+                                   t_enter)) {
+                    pending.emplace_back(t_enter, child);
+                    std::push_heap(pending.begin(), pending.end(), farther_node);
+                }
+            }
+            continue;
+        }
+        n_tested += n.n_primitives;
+        const size_t end = n.offset + n.n_primitives;
+        for (size_t k = n.offset; k < end; k += FloatLanes::width) {
+            alignas(32) std::array<float, FloatLanes::width> t, u, v;
+            const int mask = intersect_triangles<true>(triangles, k, sheared, t_max, t.data(),
+                                                       u.data(), v.data());
+            const size_t count = std::min<size_t>(FloatLanes::width, end - k);
+            for (size_t i = 0; i < count; i++) {
+                if (((mask >> i) & 1) && t[i] >= t_min) {
+                    hits.push_back({t[i], k + i, u[i], v[i]});
+                    std::push_heap(hits.begin(), hits.end(), farther_hit);
+                }
+            }
+        }
+    }
+    if (running) {
+        report(std::numeric_limits<float>::infinity());
+    }
+    traversal_counters.record(0, n_visited, n_tested);
+    return n_reported;
+}
+// 邻近查询：深度优先遍历二叉树，跳过比当前最近距离更远的包围盒
+template<typename F>
+optional<Proximity> BVH::nearest(const Vector3f& point, float max_distance, F&& measure) const
+{
+    if (nodes.empty()) {
+        return std::nullopt;
+    }
+    optional<Proximity> result;
+    float best = max_distance;
+    // popping a node pushes its two children, so every level leaves at most one node behind
+    std::array<size_t, max_depth + 1> stack;
+    size_t stack_size   = 0;
+    size_t n_visited    = 0;
+    size_t n_tested     = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+        const size_t current = stack[--stack_size];
+        const BVHNode& n     = nodes[current];
+        ++n_visited;
+        if (box_distance(n.aabb, point) > best) {
+            continue;
+        }
+        if (n.n_primitives == 0) {
+            // the child popped next is the nearer one
+            const size_t left  = current + 1;
+            const size_t right = n.offset;
+            if (box_distance(nodes[left].aabb, point) < box_distance(nodes[right].aabb, point)) {
+                stack[stack_size++] = right;
+                stack[stack_size++] = left;
+            } else {
+                stack[stack_size++] = left;
+                stack[stack_size++] = right;
+            }
+            continue;
+        }
+        n_tested += n.n_primitives;
+        for (size_t i = n.offset; i < n.offset + n.n_primitives; i++) {
+            for (int k = 0; k < 3; k++) {
+                Vector3f closest;
+                const float distance = measure(i, k, closest);
+                if (distance <= best) {
+                    best   = distance;
+                    result = Proximity{primitives[i], k, distance, closest};
+                }
+            }
+        }
+    }
+    traversal_counters.record(0, n_visited, n_tested);
+    return result;
+}
+// 离给定点最近的顶点
+optional<Proximity> BVH::nearest_vertex(const Vector3f& point, float max_distance) const
+{
+    return nearest(point, max_distance, [&](size_t i, int k, Vector3f& closest) {
+        closest = stored_vertex(triangles, i, k);
+        return (closest - point).norm();
+    });
+}
+// 离给定点最近的边：点投影到边所在的直线上，再截取到两个端点之间
+optional<Proximity> BVH::nearest_edge(const Vector3f& point, float max_distance) const
+{
+    return nearest(point, max_distance, [&](size_t i, int k, Vector3f& closest) {
+        const Vector3f a       = stored_vertex(triangles, i, k);
+        const Vector3f edge    = stored_vertex(triangles, i, (k + 1) % 3) - a;
+        const float length_sqr = edge.squaredNorm();
+        const float s          = length_sqr > 0.0f ? (point - a).dot(edge) / length_sqr : 0.0f;
+        closest                = a + clamp(0.0f, 1.0f, s) * edge;
+        return (closest - point).norm();
+    });
+}
+#if DANDELION_BVH_WIDTH > 2
+// 把二叉子树压缩成一个宽节点，内部子节点在它之后递归地压缩
+size_t BVH::collapse(size_t node)
+{
+    const size_t index = wide_nodes.size();
+    wide_nodes.emplace_back();
+    std::array<size_t, bvh_width> children;
+    size_t n_children = 1;
+    children[0]       = node;
+    while (n_children < bvh_width) {
+        // open the interior child with the largest surface area
+        int largest        = -1;
+        float largest_area = -1.0f;
+        for (size_t i = 0; i < n_children; i++) {
+            const BVHNode& child = nodes[children[i]];
+            if (child.n_primitives == 0 && child.aabb.surface_area() > largest_area) {
+                largest      = static_cast<int>(i);
+                largest_area = child.aabb.surface_area();
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        const size_t opened    = children[largest];
+        children[largest]      = opened + 1;
+        children[n_children++] = nodes[opened].offset;
+    }
+    for (size_t i = 0; i < bvh_width; i++) {
+        // unused slots keep an empty box
+        const AABB box = i < n_children ? nodes[children[i]].aabb : AABB();
+        for (int axis = 0; axis < 3; axis++) {
+            wide_nodes[index].bounds[axis][i]     = box.p_min[axis];
+            wide_nodes[index].bounds[axis + 3][i] = box.p_max[axis];
+        }
+        wide_nodes[index].offset[i]       = 0;
+        wide_nodes[index].n_primitives[i] = 0;
+        if (i < n_children) {
+            const BVHNode& child = nodes[children[i]];
+            if (child.n_primitives > 0) {
+                wide_nodes[index].offset[i]       = child.offset;
+                wide_nodes[index].n_primitives[i] = child.n_primitives;
+            } else {
+                // wide_nodes may be reallocated by the recursion
+                const size_t wide_child     = collapse(children[i]);
+                wide_nodes[index].offset[i] = static_cast<std::uint32_t>(wide_child);
+            }
+        }
+    }
+    return index;
+}
+// 遍历宽 BVH ：叶子立即求交，内部子节点按进入距离从远到近压栈，先弹出最近的一个
+optional<Intersection> BVH::wide_intersect(const Ray& ray) const
+{
+    WideRay wide_ray;
+    for (int axis = 0; axis < 3; axis++) {
+        const bool negative     = ray.direction[axis] < 0.0f;
+        wide_ray.origin[axis]   = ray.origin[axis];
+        wide_ray.inv_dir[axis]  = 1.0f / ray.direction[axis];
+        wide_ray.near_row[axis] = negative ? axis + 3 : axis;
+        wide_ray.far_row[axis]  = negative ? axis : axis + 3;
+    }
+    struct Entry
+    {
+        std::uint32_t node;
+        float t_enter;
+    };
+    const ShearedRay sheared = shear(ray);
+    TriangleHit hit;
+    bool found = false;
+    // every level of the tree leaves at most bvh_width - 1 entries on the stack
+    std::array<Entry, max_depth * (bvh_width - 1) + 1> stack;
+    size_t stack_size   = 0;
+    size_t n_visited    = 0;
+    size_t n_tested     = 0;
+    stack[stack_size++] = {0, 0.0f};
+    while (stack_size > 0) {
+        const Entry entry = stack[--stack_size];
+        if (entry.t_enter > hit.t) {
+            continue;
+        }
+        const WideBVHNode& node = wide_nodes[entry.node];
+        ++n_visited;
+        alignas(32) std::array<float, bvh_width> t_enter;
+        const int mask = intersect_children(node, wide_ray, hit.t, t_enter.data());
+        std::array<Entry, bvh_width> children;
+        size_t n_children = 0;
+        for (size_t i = 0; i < bvh_width; i++) {
+            if (!((mask >> i) & 1)) {
+                continue;
+            }
+            if (node.n_primitives[i] == 0) {
+                // insertion sort by the entering t, from far to near
+                size_t j = n_children++;
+                for (; j > 0 && children[j - 1].t_enter < t_enter[i]; j--) {
+                    children[j] = children[j - 1];
+                }
+                children[j] = {node.offset[i], t_enter[i]};
+                continue;
+            }
+            found |= intersect_leaf(triangles, node.offset[i], node.n_primitives[i], sheared, hit);
+            n_tested += node.n_primitives[i];
+        }
+        for (size_t i = 0; i < n_children; i++) {
+            stack[stack_size++] = children[i];
+        }
+    }
+    traversal_counters.record(0, n_visited, n_tested);
+    if (!found) {
+        return std::nullopt;
+    }
+    return make_intersection(triangles, primitives, hit);
+}
+// 在宽 BVH 中做阴影测试：子节点不需要排序，命中的叶子中有任何一个交点就返回
+bool BVH::wide_occluded(const Ray& ray, float t_max) const
+{
+    WideRay wide_ray;
+    for (int axis = 0; axis < 3; axis++) {
+        const bool negative     = ray.direction[axis] < 0.0f;
+        wide_ray.origin[axis]   = ray.origin[axis];
+        wide_ray.inv_dir[axis]  = 1.0f / ray.direction[axis];
+        wide_ray.near_row[axis] = negative ? axis + 3 : axis;
+        wide_ray.far_row[axis]  = negative ? axis : axis + 3;
+    }
+    const ShearedRay sheared = shear(ray);
+    std::array<std::uint32_t, max_depth * (bvh_width - 1) + 1> stack;
+    size_t stack_size   = 0;
+    size_t n_visited    = 0;
+    size_t n_tested     = 0;
+    bool hit            = false;
+    stack[stack_size++] = 0;
+    while (stack_size > 0 && !hit) {
+        const WideBVHNode& node = wide_nodes[stack[--stack_size]];
+        ++n_visited;
+        alignas(32) std::array<float, bvh_width> t_enter;
+        const int mask = intersect_children(node, wide_ray, t_max, t_enter.data());
+        for (size_t i = 0; i < bvh_width; i++) {
+            if (!((mask >> i) & 1)) {
+                continue;
+            }
+            if (node.n_primitives[i] == 0) {
+                stack[stack_size++] = node.offset[i];
+                continue;
+            }
+            n_tested += node.n_primitives[i];
+            if (occluded_leaf(triangles, node.offset[i], node.n_primitives[i], sheared, t_max)) {
+                hit = true;
+                break;
+            }
+        }
+    }
+    traversal_counters.record(0, n_visited, n_tested);
+    return hit;
 }
+#endif
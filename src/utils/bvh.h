@@ -4,10 +4,17 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <array>
+#include <functional>
+#include <atomic>
+#include <string>
 
 #include "../src/platform/gl.hpp"
 #include "./ray.h"
 #include "aabb.h"
+#include "thread_pool.h"
 
 /*!
  * \file utils/bvh.h
@@ -17,36 +24,262 @@
  * \ingroup utils
  * \~chinese
  * \brief 表示的是BVH建立的树中的节点
+ *
+ * 所有节点按深度优先的顺序存储在 `BVH::nodes` 这一个数组中，内部节点的左子节点
+ * 紧跟在它后面，右子节点由 `offset` 给出，因此节点不需要保存指针，大小恰好为 32 字节，
+ * 两个节点占满一条 64 字节的缓存行。
  */
-struct BVHNode
+struct alignas(32) BVHNode
 {
     /*! \~english Initialization of the BVHNode */
     BVHNode();
     /*! \~english Aligned-axis bounding box */
     AABB aabb;
-    /*! \~english left node of the BVHNode */
-    BVHNode* left;
-    /*! \~english right node of the BVHNode */
-    BVHNode* right;
-    /*! \~english face index of current node, initialized to 0
-     *  will only >0 in leaf nodes(the number of faces it covers <= 1)
-     */
-    size_t face_idx;
+    /*!
+     * \~english index of the first face in `BVH::primitives` for leaf nodes, or index of
+     * the right child in `BVH::nodes` for interior nodes
+     */
+    std::uint32_t offset;
+    /*! \~english number of faces covered by a leaf node, 0 for interior nodes */
+    std::uint16_t n_primitives;
+    /*! \~english axis (0, 1, 2 for x, y, z) along which an interior node is split */
+    std::uint8_t axis;
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVH nodes are expected to be 32 bytes");
+
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief 求交时 BVH 的分叉数，由 CMake 选项 `DANDELION_BVH_WIDTH` 决定
+ *
+ * 为 2 时直接遍历二叉树；为 4 或 8 时二叉树在构建后被压缩成宽 BVH (BVH4 / BVH8) ，
+ * 每个宽节点的所有子节点包围盒由 `FloatLanes` 同时测试。
+ */
+#ifndef DANDELION_BVH_WIDTH
+#define DANDELION_BVH_WIDTH 2
+#endif
+static_assert(DANDELION_BVH_WIDTH == 2 || DANDELION_BVH_WIDTH == 4 || DANDELION_BVH_WIDTH == 8,
+              "the BVH width can only be 2, 4 or 8");
+constexpr std::size_t bvh_width = DANDELION_BVH_WIDTH;
+
+#if DANDELION_BVH_WIDTH > 2
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief 宽 BVH 的节点，最多有 `bvh_width` 个子节点
+ *
+ * 子节点的包围盒按 SoA 方式存储：`bounds` 的 6 行依次是所有子节点的
+ * \f$x_{min}, y_{min}, z_{min}, x_{max}, y_{max}, z_{max}\f$ ，
+ * 因此一条 SIMD 指令就能处理所有子节点的同一个坐标。空闲的位置存储一个空包围盒，
+ * 不会与任何射线相交。
+ */
+struct alignas(32) WideBVHNode
+{
+    float bounds[6][bvh_width];
+    /*! \~chinese 叶子的第一个面片在 `BVH::primitives` 中的序号，或内部子节点在 `BVH::wide_nodes` 中的序号 */
+    std::uint32_t offset[bvh_width];
+    /*! \~chinese 叶子包含的面片数，内部子节点和空闲位置为 0 */
+    std::uint16_t n_primitives[bvh_width];
+};
+#endif
+
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief 按 `BVH::primitives` 的顺序预先取出的三角形，叶节点中的面片由此一次测试多个
+ *
+ * 坐标按 SoA 方式存储：`vertices[3 * k + axis][i]` 是第 i 个图元第 k 个顶点的 axis 坐标，
+ * `normals[axis][i]` 是它的单位法向量（模型坐标系下）。求交时不再经过 `GL::Mesh` 读取顶点。
+ * 每个数组末尾多留 `padding` 个退化的三角形，从任何一个面片开始读取一组面片都不会越界。
+ */
+struct TriangleStore
+{
+    /*! \~chinese 数组末尾多留的空位数，不少于任何 SIMD 实现的通道数 */
+    static constexpr std::size_t padding = 8;
+    std::array<std::vector<float>, 9> vertices;
+    std::array<std::vector<float>, 3> normals;
+};
+
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief `BVH::nearest_vertex` 和 `BVH::nearest_edge` 找到的离查询点最近的顶点或边
+ *
+ * 顶点或边用它所在的一个面片表示：面片的第 k 条边连接它的第 k 个和第 k + 1 个顶点。
+ * 被多个面片共用的顶点或边可能由其中任何一个面片报告。
+ */
+struct Proximity
+{
+    /*! \~chinese 顶点或边所在的面片在 mesh 中的序号 */
+    std::size_t face_index;
+    /*! \~chinese 顶点或边在这个面片中的序号 (0, 1, 2) */
+    int element;
+    /*! \~chinese 到查询点的距离 */
+    float distance;
+    /*! \~chinese 顶点或边上离查询点最近的点 */
+    Eigen::Vector3f point;
 };
 
 /*!
  * \ingroup utils
  * \~chinese
- * \brief 用于在BVH划分左右子树时作为参与排序的节点
+ * \brief 一棵 BVH 的质量和开销统计，在 `BVH::build` 、`BVH::refit` 和 `BVH::load` 后更新
  */
-struct SortNode
+struct BVHStats
 {
-    /*! \~english face index of the sorted node */
-    size_t index;
-    /*! \~english centroid of the current AABB */
-    Eigen::Vector3f centroid;
+    std::size_t n_nodes  = 0;
+    std::size_t n_leaves = 0;
+    /*! \~chinese SAH 代价，与 `BVH::sah_cost` 相同 */
+    float sah_cost = 0.0f;
+    /*! \~chinese 所有内部节点的两个子节点包围盒重叠部分的表面积之和，同样除以根节点的表面积 */
+    float overlap = 0.0f;
+    /*! \~chinese 最大深度，根节点的深度为 1 */
+    std::size_t max_depth = 0;
+    /*! \~chinese 叶节点的平均深度 */
+    float average_depth = 0.0f;
+    /*! \~chinese 第 i 个元素是恰好包含 i 个面片的叶节点数 */
+    std::vector<std::size_t> leaf_size_histogram;
+    /*! \~chinese 最近一次构建或从缓存读取所用的时间（秒） */
+    float build_time = 0.0f;
+    /*! \~chinese 这棵 BVH 占用的内存（字节），包括为重新构建保留的缓冲区 */
+    std::size_t memory = 0;
+
+    /*! \~chinese 以 JSON 对象的格式输出所有统计量 */
+    std::string to_json() const;
 };
 
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief 所有线程共享的 BVH 遍历计数器，用来判断渲染慢是因为树的质量还是着色
+ *
+ * 只有 `enabled` 为 true 时才累计。每次查询在局部变量中计数，结束时才调用一次 `record` ，
+ * 关闭时的开销只有一次原子读取。射线只在场景级的 `TLAS` 查询中计数，访问的节点包括
+ * TLAS 和各物体 BVH 的节点。
+ */
+struct TraversalCounters
+{
+    std::atomic<bool> enabled{false};
+    std::atomic<std::uint64_t> rays{0};
+    std::atomic<std::uint64_t> nodes_visited{0};
+    std::atomic<std::uint64_t> triangles_tested{0};
+
+    /*! \~chinese 在 `enabled` 时累计一次查询的计数 */
+    void record(std::uint64_t n_rays, std::uint64_t n_nodes, std::uint64_t n_triangles)
+    {
+        if (!enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        rays.fetch_add(n_rays, std::memory_order_relaxed);
+        nodes_visited.fetch_add(n_nodes, std::memory_order_relaxed);
+        triangles_tested.fetch_add(n_triangles, std::memory_order_relaxed);
+    }
+    /*! \~chinese 清零所有计数，不改变 `enabled` */
+    void reset();
+    /*! \~chinese 以 JSON 对象的格式输出计数和每条射线的平均值 */
+    std::string to_json() const;
+};
+
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief 一起遍历 BVH 的一组射线（射线包），用于方向相近的主光线和阴影光线
+ *
+ * 射线的参数按 SoA 方式存储，每个节点的包围盒由 `FloatLanes` 同时与所有射线求交。
+ * 所有射线在各个轴上方向的符号相同时，包还有一个由区间算术得到的保守的“视锥”：
+ * 包围盒在这个视锥之外时不必逐个测试射线就能剔除整个节点。
+ */
+struct RayPacket
+{
+    /*! \~chinese 一个包最多包含的射线数 */
+    static constexpr std::size_t size = 8;
+    /*! \~chinese 包中的射线数，多余的通道不参与求交 */
+    std::size_t n;
+    alignas(32) float origin[3][size];
+    alignas(32) float inv_dir[3][size];
+    /*! \~chinese 每条射线的求交范围上界，找到交点后缩小为交点的 t */
+    alignas(32) float t_max[size];
+    /*! \~chinese 所有射线在各个轴上方向的符号是否相同，相同时才使用区间剔除 */
+    bool coherent;
+    /*! \~chinese 所有射线起点和方向倒数的取值区间，仅在 `coherent` 时有效 */
+    Eigen::Vector3f origin_min, origin_max, inv_dir_min, inv_dir_max;
+
+    /*!
+     * \~chinese
+     * \brief 用给定的射线初始化射线包
+     *
+     * \param rays 射线数组
+     * \param count 射线数，不能超过 `size`
+     * \param t_max 每条射线的求交范围上界
+     */
+    void set(const Ray* rays, std::size_t count, const float* t_max);
+    /*!
+     * \~chinese
+     * \brief 返回在 \f$[0, t_{max}]\f$ 内与包围盒相交的射线
+     *
+     * \param box 包围盒
+     * \param active 参与测试的射线，第 i 位对应第 i 条射线
+     * \returns 相交的射线，格式与 `active` 相同
+     */
+    int intersect(const AABB& box, int active) const;
+};
+
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief 用射线包遍历按 `BVHNode` 格式存储的树
+ *
+ * 每个节点只对仍然与它的祖先相交的射线求交。内部节点按包中第一条活动射线的方向
+ * 决定先访问哪个子节点。到达叶节点时调用 `leaf(node, mask)` ，由调用者对 `mask`
+ * 中的射线求交，并相应地缩小 `packet.t_max` 。返回访问的节点数。
+ */
+template<typename F>
+std::size_t traverse_packet(const std::vector<BVHNode>& nodes, RayPacket& packet, F&& leaf)
+{
+    if (nodes.empty() || packet.n == 0) {
+        return 0;
+    }
+    // every level of the tree leaves at most one node on the stack, and trees built here are
+    // no deeper than 64
+    struct Entry
+    {
+        std::uint32_t node;
+        int mask;
+    };
+    std::array<Entry, 65> stack;
+    std::size_t stack_size = 0;
+    std::size_t n_visited  = 0;
+    stack[stack_size++]    = {0, (1 << packet.n) - 1};
+    while (stack_size > 0) {
+        const Entry entry = stack[--stack_size];
+        const BVHNode& n  = nodes[entry.node];
+        ++n_visited;
+        const int mask    = packet.intersect(n.aabb, entry.mask);
+        if (mask == 0) {
+            continue;
+        }
+        if (n.n_primitives > 0) {
+            leaf(n, mask);
+            continue;
+        }
+        int first = 0;
+        while (!((mask >> first) & 1)) {
+            ++first;
+        }
+        const std::uint32_t left  = entry.node + 1;
+        const std::uint32_t right = n.offset;
+        if (packet.inv_dir[n.axis][first] < 0.0f) {
+            stack[stack_size++] = {left, mask};
+            stack[stack_size++] = {right, mask};
+        } else {
+            stack[stack_size++] = {right, mask};
+            stack[stack_size++] = {left, mask};
+        }
+    }
+    return n_visited;
+}
+
 class BVH
 {
 public:
@@ -60,14 +293,73 @@ public:
      */
     BVH(const GL::Mesh& mesh);
 
-    /*! \~chinese 建立整个object的bvh的函数调用接口 */
+    /*!
+     * \~chinese
+     * \brief 建立整个object的bvh的函数调用接口
+     *
+     * 使用分桶 (binned) 的表面积启发式 (SAH) 选择划分平面，所有节点共用 `primitives`
+     * 这一个索引数组，构建过程中只在数组上原地划分。构建完成后 `sah_cost` 和 `depth`
+     * 记录了这棵树的 SAH 代价和深度。
+     *
+     * `parallel_build` 为 true 时，面片数不少于 `parallel_threshold` 的节点由
+     * `RenderEngine::thread_pool()` 并行构建：包围盒和分桶按段并行统计后合并，
+     * 左子树作为任务提交到线程池，与右子树同时构建。得到的树与串行构建的相同。
+     *
+     * 重新构建时复用上一棵树的节点数组、面片索引和构建时的临时数组，清空它们是常数时间的，
+     * 面片数不变的串行构建不会分配新的内存。并行构建时，每个交给线程池的节点的两棵子树
+     * 各自按节点数的上界分配一次数组，合并后释放。不再重新构建时可以调用
+     * `release_build_memory` 归还内存。
+     */
     void build();
-
-    /*! \~chinese 删除建立的整个bvh */
-    void recursively_delete(BVHNode* node);
+    /*!
+     * \~chinese
+     * \brief 释放构建时使用的临时数组，并把节点数组的容量缩减到实际大小
+     *
+     * 适用于加载后不再编辑的 mesh 。之后再调用 `build` 仍然正确，只是需要重新分配内存。
+     */
+    void release_build_memory();
+    /*!
+     * \~chinese
+     * \brief 顶点移动而连接关系不变时，保持树的结构，自底向上重新计算所有节点的包围盒
+     *
+     * 同时重新计算 `sah_cost` 。面片数与构建时不同，或者 SAH 代价超过构建时的
+     * `max_refit_cost_ratio` 倍时返回 false ，此时应当调用 `build` 重新构建。
+     * 面片的连接关系是否改变由调用者保证，这个函数只检查面片数。
+     */
+    bool refit();
+    /*!
+     * \~chinese
+     * \brief 从 `cache_directory` 中读取这个 mesh 的 BVH ，缓存不存在或无效时调用 `build`
+     * 重新构建，并把结果写入缓存
+     *
+     * 缓存文件以 `mesh_hash` 命名，因此同一个模型无论从哪个文件加载都能命中缓存。
+     * 面片数少于 `cache_threshold` 的 mesh 构建很快，直接调用 `build` 。
+     *
+     * \returns 是否从缓存中读取了 BVH
+     */
+    bool load_or_build();
+    /*!
+     * \~chinese
+     * \brief 把构建好的树写入文件，返回是否成功
+     *
+     * 先写入同一目录下的临时文件再重命名，其他线程或进程不会读到写了一半的文件。
+     */
+    bool save(const std::string& path) const;
+    /*!
+     * \~chinese
+     * \brief 读取 `save` 写出的文件，返回是否成功
+     *
+     * 文件中记录的 mesh 哈希、面片数和 `max_leaf_size` 必须与当前的一致，
+     * 所有节点和图元索引也都要通过检查，否则保持当前的树不变并返回 false 。
+     */
+    bool load(const std::string& path);
+    /*! \~chinese 根据顶点坐标和面片计算 mesh 内容的 64 位哈希 (FNV-1a) ，用作缓存文件的键 */
+    static std::uint64_t mesh_hash(const GL::Mesh& mesh);
 
     /*! \~chinese 统计当前bvh的节点总数 */
-    size_t count_nodes(BVHNode* node);
+    size_t count_nodes() const;
+    /*! \~chinese 这棵 BVH 当前占用的内存（字节） */
+    std::size_t memory_usage() const;
     /*!
      * \~chinese
      * \brief BVH加速求交的函数调用接口
@@ -77,28 +369,196 @@ public:
      * \param obj_model 当前mesh所在object的model矩阵
      */
     std::optional<Intersection> intersect(const Ray& ray, const GL::Mesh& mesh,
-                                          const Eigen::Matrix4f obj_model);
+                                          const Eigen::Matrix4f obj_model) const;
 
     /*!
      * \~chinese
      * \brief 获取BVH求交的结果
-     * \param node 求交的节点
-     * \param ray 求交的射线
+     *
+     * 求交在模型坐标系下进行，返回的结果也在模型坐标系下。遍历使用显式的栈而不是递归，
+     * 并且先访问射线方向上较近的子节点，以便尽早缩小求交范围。
+     *
+     * \param node 求交的节点在 `nodes` 中的序号
+     * \param ray 模型坐标系下的射线
+     */
+    std::optional<Intersection> ray_node_intersect(std::size_t node, const Ray& ray) const;
+    /*!
+     * \~chinese
+     * \brief 按射线包批量求交
+     *
+     * 连续的每 `RayPacket::size` 条射线组成一个包一起遍历这棵树，适合方向相近的射线。
+     * `results` 既是输入也是输出：其中已有的 `t` 是对应射线的求交范围上界，
+     * 找到更近的交点时才被覆盖，因此可以依次对多个物体调用；初始值应为 `Intersection()` 。
+     *
+     * \param rays 世界坐标系下的射线
+     * \param n 射线数
+     * \param obj_model 当前mesh所在object的model矩阵
+     * \param results 每条射线的交点（世界坐标系下）
+     * \returns 找到了更近交点的射线数
+     */
+    std::size_t intersect_n(const Ray* rays, std::size_t n, const Eigen::Matrix4f& obj_model,
+                            Intersection* results) const;
+    /*!
+     * \~chinese
+     * \brief 判断射线在 \f$t \in (0, t_{max})\f$ 的范围内是否被任何面片遮挡，用于阴影测试
+     *
+     * 找到第一个交点就立即返回，不计算重心坐标和法向量，也不需要找到最近的交点。
+     *
+     * \param ray 世界坐标系下的射线
+     * \param obj_model 当前mesh所在object的model矩阵
+     * \param t_max 求交范围的上界（世界坐标系下），通常是到光源的距离
+     */
+    bool occluded(const Ray& ray, const Eigen::Matrix4f& obj_model, float t_max) const;
+    /*!
+     * \~chinese
+     * \brief 按 t 从小到大依次报告射线在 \f$t \in [t_{min}, t_{max}]\f$ 范围内的所有交点
+     *
+     * 用于测量厚度、半透明物体和按边检测碰撞等需要不止一个交点的场合。所有交点在同一次遍历中
+     * 得到：节点按射线进入包围盒的距离从近到远访问，交点要等到不可能再找到更近的交点后才交给
+     * `callback` 。`callback` 返回 false 时立即停止遍历。射线恰好穿过相邻面片的公共边或顶点时，
+     * 这些面片的交点会分别报告一次。可以被多个线程同时调用。
+     *
+     * \param ray 世界坐标系下的射线
+     * \param obj_model 当前mesh所在object的model矩阵
+     * \param t_min 求交范围的下界（世界坐标系下）
+     * \param t_max 求交范围的上界（世界坐标系下）
+     * \param callback 接收每个交点（世界坐标系下），返回是否继续查找更远的交点
+     * \returns 报告的交点数
      */
-    std::optional<Intersection> ray_node_intersect(BVHNode* node, const Ray& ray) const;
+    std::size_t intersect_all(const Ray& ray, const Eigen::Matrix4f& obj_model, float t_min,
+                              float t_max,
+                              const std::function<bool(const Intersection&)>& callback) const;
 
-    /*! \~chinese 整个bvh的根节点 */
-    BVHNode* root;
+    /*!
+     * \~chinese
+     * \brief 找到离给定点最近、距离不超过 `max_distance` 的顶点，用于拾取顶点
+     *
+     * 只访问与给定点的距离小于当前最近距离的节点，先访问较近的子节点。
+     * 点和距离都在模型坐标系下，没有这样的顶点时返回 `std::nullopt` 。
+     */
+    std::optional<Proximity> nearest_vertex(const Eigen::Vector3f& point,
+                                            float max_distance) const;
+    /*! \~chinese 与 `nearest_vertex` 相同，但查询的是离给定点最近的边（线段），用于拾取边 */
+    std::optional<Proximity> nearest_edge(const Eigen::Vector3f& point, float max_distance) const;
 
-    /*! \~chinese 建立整个object的bvh的函数具体实现，边界条件为覆盖的面片数<=1 */
-    BVHNode* recursively_build(std::vector<size_t> faces_idx);
+    /*! \~chinese 按深度优先顺序存储的所有节点，第一个是根节点；没有面片时为空 */
+    std::vector<BVHNode> nodes;
+#if DANDELION_BVH_WIDTH > 2
+    /*! \~chinese 由 `nodes` 压缩得到的宽 BVH ，第一个是根节点，`build` 和 `refit` 后重新生成 */
+    std::vector<WideBVHNode> wide_nodes;
+#endif
 
     /*! \~chinese 当前bvh所在object的mesh */
     const GL::Mesh& mesh;
-    /*! \~chinese 当前mesh的所有图元索引 */
+    /*! \~chinese 当前mesh的所有图元索引，按叶节点的顺序排列，每个叶节点覆盖其中连续的一段 */
     std::vector<size_t> primitives;
-    /*! \~chinese 当前bvh所在object的model矩阵 */
-    Eigen::Matrix4f model;
+    /*! \~chinese 与 `primitives` 顺序相同的三角形数据，`build` 和 `refit` 时重新生成 */
+    TriangleStore triangles;
+    /*! \~chinese 叶节点最多包含的面片数，默认为 4 ，不能超过 65535 */
+    size_t max_leaf_size;
+    /*! \~chinese 是否使用线程池并行构建，默认为 true ，可以对每个物体分别设置 */
+    bool parallel_build;
+    /*! \~chinese 构建得到的树的 SAH 代价（以穿过根节点的射线的期望求交次数计） */
+    float sah_cost;
+    /*! \~chinese 构建得到的树的深度 */
+    size_t depth;
+    /*! \~chinese 上一次构建完成时的 SAH 代价，`refit` 用它判断树的质量是否下降过多 */
+    float built_sah_cost;
+    /*! \~chinese 树的质量和开销统计 */
+    BVHStats stats;
+    /*! \~chinese 所有 BVH 和 TLAS 共享的遍历计数器 */
+    static TraversalCounters traversal_counters;
+
+    /*! \~chinese 并行构建时，面片数不少于这个值的节点才会使用线程池 */
+    static constexpr std::size_t parallel_threshold = 16384;
+    /*! \~chinese refit 后的 SAH 代价超过构建时的这个倍数时需要重新构建 */
+    static constexpr float max_refit_cost_ratio = 1.5f;
+    /*! \~chinese 面片数不少于这个值的 mesh 才使用磁盘上的缓存 */
+    static constexpr std::size_t cache_threshold = 65536;
+    /*! \~chinese 存放 BVH 缓存文件的目录，相对于当前工作目录 */
+    static constexpr const char* cache_directory = "bvh_cache";
+
+private:
+    /*!
+     * \~chinese
+     * \brief 构建中的一棵子树，并行构建的两个子树分别写入不同的 `Subtree`
+     *
+     * 内部节点的 `offset` 是子树内的序号，叶节点的 `offset` 总是 `primitives` 中的序号。
+     */
+    struct Subtree
+    {
+        std::vector<BVHNode> nodes;
+        float sah_cost    = 0.0f;
+        std::size_t depth = 0;
+    };
+    /*!
+     * \~chinese
+     * \brief 建立整个object的bvh的函数具体实现
+     *
+     * 为 `primitives` 中 \f$[begin, end)\f$ 范围内的面片建立子树，这个范围会被原地重排。
+     * 面片数不超过 `max_leaf_size` 且 SAH 认为不值得继续划分时成为叶节点。
+     *
+     * \param begin 面片范围的起点
+     * \param end 面片范围的终点（不含）
+     * \param depth 当前节点的深度，根节点为 1
+     * \param output 子树的节点追加到其中，并在其中累计 SAH 代价和深度
+     * \return 子树的根节点在 `output.nodes` 中的序号
+     */
+    std::size_t recursively_build(size_t begin, size_t end, size_t depth, Subtree& output);
+    /*! \~chinese 一个节点的面片最多被分成多少段并行处理 */
+    static constexpr std::size_t max_chunks = 16;
+
+    /*!
+     * \~chinese
+     * \brief 把面片范围分段并对每段调用 `f(chunk, first, last)` ，返回段数
+     *
+     * 不并行构建或面片数少于 `parallel_threshold` 时只有一段，直接在当前线程中调用。
+     */
+    template<typename F>
+    std::size_t for_each_chunk(std::size_t begin, std::size_t end, F&& f);
+    /*!
+     * \~chinese
+     * \brief `nearest_vertex` 和 `nearest_edge` 共用的遍历
+     *
+     * `measure(i, k, closest)` 返回 `point` 到 `triangles` 中第 i 个面片的第 k 个元素的距离，
+     * 并把元素上最近的点写入 `closest` 。
+     */
+    template<typename F>
+    std::optional<Proximity> nearest(const Eigen::Vector3f& point, float max_distance,
+                                     F&& measure) const;
+    /*! \~chinese 把 `subtree` 的节点追加到 `output` 末尾，并合并 SAH 代价和深度 */
+    static void splice(Subtree& subtree, Subtree& output);
+    /*!
+     * \~chinese
+     * \brief 根据当前的树重新计算 `stats` 中除 `build_time` 以外的统计量
+     */
+    void update_stats();
+    /*! \~chinese `save` 的实现，`hash` 是已经算好的当前 mesh 的哈希 */
+    bool save(const std::string& path, std::uint64_t hash) const;
+    /*! \~chinese `load` 的实现，`hash` 是已经算好的当前 mesh 的哈希 */
+    bool load(const std::string& path, std::uint64_t hash);
+    /*! \~chinese 按 `primitives` 的顺序从 `mesh` 中重新取出所有三角形，写入 `triangles` */
+    void store_triangles();
+#if DANDELION_BVH_WIDTH > 2
+    /*!
+     * \~chinese
+     * \brief 把以 `nodes[node]` 为根的二叉子树压缩成宽 BVH ，返回根节点在 `wide_nodes` 中的序号
+     *
+     * 从这个节点开始，每次展开表面积最大的内部子节点，直到子节点数达到 `bvh_width`
+     * 或者全部是叶子，然后对剩下的内部子节点递归地压缩。
+     */
+    std::size_t collapse(std::size_t node);
+    /*! \~chinese 在宽 BVH 中求模型坐标系下的射线的最近交点 */
+    std::optional<Intersection> wide_intersect(const Ray& ray) const;
+    /*! \~chinese 在宽 BVH 中判断模型坐标系下的射线是否被遮挡 */
+    bool wide_occluded(const Ray& ray, float t_max) const;
+#endif
+
+    /*! \~chinese 构建时使用的线程池，串行构建时为空 */
+    ThreadPool* pool = nullptr;
+    /*! \~chinese 构建时使用的每个面片的包围盒和中心，保留到下一次构建或 `release_build_memory` */
+    std::vector<AABB> primitive_boxes;
+    std::vector<Eigen::Vector3f> primitive_centroids;
 };
 
 #endif // DANDELION_UTILS_BVH_H
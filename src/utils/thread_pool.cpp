@@ -0,0 +1,165 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+using std::size_t;
+
+namespace {
+
+// The pool (if any) that owns the current thread, and the queue index of the thread.
+thread_local const ThreadPool* owner_pool = nullptr;
+thread_local size_t owner_index           = 0;
+
+} // namespace
+
+ThreadPool::TaskGroup::TaskGroup() : n_pending(0)
+{
+}
+
+ThreadPool::ThreadPool(size_t n_workers) : n_queued(0), next_queue(0), stopping(false)
+{
+    start(n_workers);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+}
+
+size_t ThreadPool::size() const
+{
+    return workers.size();
+}
+
+void ThreadPool::resize(size_t n_workers)
+{
+    n_workers = std::max<size_t>(n_workers, 1);
+    if (n_workers == workers.size()) {
+        return;
+    }
+    stop();
+    start(n_workers);
+}
+
+void ThreadPool::start(size_t n_workers)
+{
+    n_workers = std::max<size_t>(n_workers, 1);
+    stopping  = false;
+    queues.clear();
+    for (size_t i = 0; i < n_workers; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    workers.reserve(n_workers);
+    for (size_t i = 0; i < n_workers; ++i) {
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake_up.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void ThreadPool::submit(TaskGroup& group, std::function<void()> task)
+{
+    group.n_pending.fetch_add(1);
+    size_t index = current_index();
+    if (index >= queues.size()) {
+        index = next_queue.fetch_add(1) % queues.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back({std::move(task), &group});
+    }
+    n_queued.fetch_add(1);
+    // Lock and unlock the sleep mutex so that a worker cannot miss this task between
+    // checking n_queued and going to sleep.
+    { std::lock_guard<std::mutex> lock(sleep_mutex); }
+    wake_up.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+    const size_t index = current_index();
+    Task task;
+    while (group.n_pending.load() > 0) {
+        if (try_pop(index, task)) {
+            run(task);
+            continue;
+        }
+        // Nothing left to help with: sleep until some task finishes. The timeout guards
+        // against tasks submitted by other workers while we are asleep.
+        std::unique_lock<std::mutex> lock(done_mutex);
+        task_done.wait_for(lock, std::chrono::microseconds(200),
+                           [&]() { return group.n_pending.load() == 0; });
+    }
+}
+
+void ThreadPool::worker_loop(size_t index)
+{
+    owner_pool  = this;
+    owner_index = index;
+    Task task;
+    while (true) {
+        if (try_pop(index, task)) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake_up.wait(lock, [this]() { return stopping || n_queued.load() > 0; });
+        if (stopping && n_queued.load() == 0) {
+            break;
+        }
+    }
+    owner_pool = nullptr;
+}
+
+bool ThreadPool::try_pop(size_t index, Task& task)
+{
+    const size_t n_queues = queues.size();
+    if (index < n_queues) {
+        WorkQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            n_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    const size_t first = index < n_queues ? index + 1 : 0;
+    for (size_t i = 0; i < n_queues; ++i) {
+        WorkQueue& victim = *queues[(first + i) % n_queues];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            n_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(Task& task)
+{
+    task.run();
+    task.run = nullptr;
+    if (task.group->n_pending.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        task_done.notify_all();
+    }
+}
+
+size_t ThreadPool::current_index() const
+{
+    return owner_pool == this ? owner_index : queues.size();
+}
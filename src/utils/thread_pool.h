@@ -0,0 +1,133 @@
+#ifndef DANDELION_UTILS_THREAD_POOL_H
+#define DANDELION_UTILS_THREAD_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * \file utils/thread_pool.h
+ * \ingroup utils
+ * \~chinese
+ * \brief 渲染器和 BVH 构建共用的常驻线程池。
+ */
+
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief 支持任务窃取 (work stealing) 的常驻线程池。
+ *
+ * 每个工作线程持有一个双端任务队列：工作线程向自己的队列尾部提交任务、也从尾部取任务，
+ * 自己的队列为空时从其他线程队列的头部“窃取”任务。外部线程提交的任务轮流放入各个队列。
+ *
+ * 任务总是属于某个 `TaskGroup` ，调用 `wait` 等待一组任务时，等待的线程也会参与执行任务，
+ * 因此在任务内部提交并等待子任务（例如递归构建 BVH）不会导致死锁。
+ *
+ * 线程池中的线程在构造时创建，直到析构或 `resize` 时才会退出，
+ * 避免了每次渲染都创建、销毁线程的开销。
+ */
+class ThreadPool
+{
+public:
+    /*!
+     * \~chinese
+     * \brief 一组可以被统一等待的任务。
+     *
+     * 任务组本身只是一个计数器，必须在所有任务完成（即 `ThreadPool::wait` 返回）后才能析构。
+     */
+    class TaskGroup
+    {
+    public:
+        TaskGroup();
+        TaskGroup(const TaskGroup& other) = delete;
+
+    private:
+        /*! \~chinese 尚未完成的任务数。 */
+        std::atomic<std::size_t> n_pending;
+        friend class ThreadPool;
+    };
+
+    /*! \~chinese 创建一个含有 `n_workers` 个工作线程的线程池（至少一个）。 */
+    explicit ThreadPool(std::size_t n_workers);
+    ThreadPool(const ThreadPool& other) = delete;
+    /*! \~chinese 等待所有已提交的任务完成后退出所有工作线程。 */
+    ~ThreadPool();
+    /*! \~chinese 工作线程的数量。 */
+    std::size_t size() const;
+    /*!
+     * \~chinese
+     * \brief 调整工作线程的数量。
+     *
+     * 调整时会先退出所有现有的工作线程，因此只应在没有任务运行时调用。
+     * 数量不变时不做任何事。
+     */
+    void resize(std::size_t n_workers);
+    /*! \~chinese 向线程池提交一个属于 `group` 的任务。 */
+    void submit(TaskGroup& group, std::function<void()> task);
+    /*! \~chinese 等待 `group` 中的任务全部完成，等待期间当前线程也会执行队列中的任务。 */
+    void wait(TaskGroup& group);
+    /*!
+     * \~chinese
+     * \brief 对 \f$[0, n)\f$ 中的每个 `i` 并行执行 `f(i)` ，全部完成后返回。
+     */
+    template<typename F>
+    void parallel_for(std::size_t n, F&& f);
+
+private:
+    struct Task
+    {
+        std::function<void()> run;
+        TaskGroup* group;
+    };
+    /*! \~chinese 每个工作线程的任务队列。 */
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void start(std::size_t n_workers);
+    void stop();
+    void worker_loop(std::size_t index);
+    /*!
+     * \~chinese
+     * \brief 取一个任务：先从第 `index` 个队列的尾部取，再从其他队列的头部窃取。
+     *
+     * `index` 不小于队列数时（即调用者不是工作线程）直接从各队列头部窃取。
+     */
+    bool try_pop(std::size_t index, Task& task);
+    void run(Task& task);
+    /*! \~chinese 当前线程在这个线程池中的队列序号，不是工作线程时返回队列数。 */
+    std::size_t current_index() const;
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    /*! \~chinese 所有队列中的任务总数，用于唤醒空闲的工作线程。 */
+    std::atomic<std::size_t> n_queued;
+    /*! \~chinese 外部线程提交任务时轮流选择队列。 */
+    std::atomic<std::size_t> next_queue;
+    bool stopping;
+    std::mutex sleep_mutex;
+    std::condition_variable wake_up;
+    std::mutex done_mutex;
+    std::condition_variable task_done;
+};
+
+template<typename F>
+void ThreadPool::parallel_for(std::size_t n, F&& f)
+{
+    TaskGroup group;
+    for (std::size_t i = 0; i < n; ++i) {
+        submit(group, [&f, i]() { f(i); });
+    }
+    wait(group);
+}
+
+#endif // DANDELION_UTILS_THREAD_POOL_H
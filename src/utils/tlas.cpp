@@ -0,0 +1,246 @@
+#include "tlas.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <numeric>
+
+using Eigen::Matrix4f;
+using Eigen::Vector3f;
+using std::optional;
+using std::size_t;
+using std::tuple;
+using std::vector;
+
+namespace {
+
+// the tree is balanced, so 64 levels are enough for any number of objects
+constexpr size_t max_depth = 64;
+
+} // namespace
+
+void TLAS::update(const vector<std::unique_ptr<Group>>& groups)
+{
+    size_t index = 0;
+    bool changed = false;
+    for (const auto& group : groups) {
+        for (const auto& object : group->objects) {
+            if (index >= instances.size() || instances[index].object != object.get()) {
+                changed = true;
+            }
+            ++index;
+        }
+    }
+    if (changed || index != instances.size()) {
+        build(groups);
+    } else {
+        refit();
+    }
+}
+
+void TLAS::build(const vector<std::unique_ptr<Group>>& groups)
+{
+    nodes.clear();
+    instances.clear();
+    for (const auto& group : groups) {
+        for (const auto& object : group->objects) {
+            instances.push_back({object.get(), Matrix4f::Identity()});
+        }
+    }
+    if (instances.empty()) {
+        return;
+    }
+    vector<AABB> boxes(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i) {
+        boxes[i] = update_instance(instances[i]);
+    }
+    vector<size_t> order(instances.size());
+    std::iota(order.begin(), order.end(), 0);
+    nodes.reserve(2 * instances.size() - 1);
+    recursively_build(0, instances.size(), order, boxes);
+}
+
+void TLAS::refit()
+{
+    // children are always stored after their parents, so a reversed sweep visits them first
+    for (size_t i = nodes.size(); i-- > 0;) {
+        BVHNode& node = nodes[i];
+        if (node.n_primitives > 0) {
+            node.aabb = update_instance(instances[node.offset]);
+        } else {
+            node.aabb = union_AABB(nodes[i + 1].aabb, nodes[node.offset].aabb);
+        }
+    }
+}
+
+AABB TLAS::update_instance(Instance& instance)
+{
+    instance.model           = instance.object->model();
+    const optional<AABB> box = instance.object->world_AABB();
+    // objects without any face get an empty box, which is never hit
+    return box.value_or(AABB());
+}
+
+size_t TLAS::recursively_build(size_t begin, size_t end, vector<size_t>& order,
+                               const vector<AABB>& boxes)
+{
+    const size_t index = nodes.size();
+    nodes.emplace_back();
+    if (end - begin == 1) {
+        nodes[index].aabb         = boxes[order[begin]];
+        nodes[index].offset       = static_cast<std::uint32_t>(order[begin]);
+        nodes[index].n_primitives = 1;
+        return index;
+    }
+    // objects are few compared with faces, so a median split is good enough here
+    AABB centroid_bounds;
+    for (size_t i = begin; i < end; ++i) {
+        centroid_bounds = union_AABB(centroid_bounds, boxes[order[i]].centroid());
+    }
+    const int axis   = centroid_bounds.max_extent();
+    const size_t mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + static_cast<std::ptrdiff_t>(begin),
+                     order.begin() + static_cast<std::ptrdiff_t>(mid),
+                     order.begin() + static_cast<std::ptrdiff_t>(end), [&](size_t a, size_t b) {
+                         return boxes[a].centroid()[axis] < boxes[b].centroid()[axis];
+                     });
+    nodes[index].axis = static_cast<std::uint8_t>(axis);
+    recursively_build(begin, mid, order, boxes);
+    const size_t right  = recursively_build(mid, end, order, boxes);
+    nodes[index].aabb   = union_AABB(nodes[index + 1].aabb, nodes[right].aabb);
+    nodes[index].offset = static_cast<std::uint32_t>(right);
+    return index;
+}
+
+optional<tuple<Intersection, Object*>> TLAS::intersect(const Ray& ray) const
+{
+    if (nodes.empty()) {
+        return std::nullopt;
+    }
+    const Vector3f inv_dir = ray.direction.cwiseInverse();
+    const std::array<int, 3> dir_is_neg = {ray.direction.x() < 0.0f, ray.direction.y() < 0.0f,
+                                           ray.direction.z() < 0.0f};
+    optional<Intersection> isect;
+    Object* hit_object = nullptr;
+    float t_max        = std::numeric_limits<float>::max();
+    std::array<size_t, max_depth> stack;
+    size_t stack_size = 0;
+    size_t current    = 0;
+    size_t n_visited  = 0;
+    while (true) {
+        const BVHNode& n = nodes[current];
+        ++n_visited;
+        if (n.aabb.intersect(ray, inv_dir, dir_is_neg, t_max)) {
+            if (n.n_primitives == 0) {
+                const size_t left  = current + 1;
+                const size_t right = n.offset;
+                if (dir_is_neg[n.axis]) {
+                    stack[stack_size++] = left;
+                    current             = right;
+                } else {
+                    stack[stack_size++] = right;
+                    current             = left;
+                }
+                continue;
+            }
+            // only objects whose bounding boxes are entered transform the ray into model space
+            const Instance& instance = instances[n.offset];
+            optional<Intersection> result =
+                instance.object->bvh->intersect(ray, instance.object->mesh, instance.model);
+            if (result.has_value() && result->t < t_max) {
+                t_max      = result->t;
+                isect      = result;
+                hit_object = instance.object;
+            }
+        }
+        if (stack_size == 0) {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+    BVH::traversal_counters.record(1, n_visited, 0);
+    if (!isect.has_value()) {
+        return std::nullopt;
+    }
+    return std::make_tuple(*isect, hit_object);
+}
+
+bool TLAS::occluded(const Ray& ray, float t_max) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+    const Vector3f inv_dir = ray.direction.cwiseInverse();
+    const std::array<int, 3> dir_is_neg = {ray.direction.x() < 0.0f, ray.direction.y() < 0.0f,
+                                           ray.direction.z() < 0.0f};
+    std::array<size_t, max_depth> stack;
+    size_t stack_size = 0;
+    size_t current    = 0;
+    size_t n_visited  = 0;
+    bool hit          = false;
+    while (true) {
+        const BVHNode& n = nodes[current];
+        ++n_visited;
+        if (n.aabb.intersect(ray, inv_dir, dir_is_neg, t_max)) {
+            if (n.n_primitives == 0) {
+                stack[stack_size++] = n.offset;
+                current             = current + 1;
+                continue;
+            }
+            const Instance& instance = instances[n.offset];
+            if (instance.object->bvh->occluded(ray, instance.model, t_max)) {
+                hit = true;
+                break;
+            }
+        }
+        if (stack_size == 0) {
+            break;
+        }
+        current = stack[--stack_size];
+    }
+    BVH::traversal_counters.record(1, n_visited, 0);
+    return hit;
+}
+
+void TLAS::intersect_n(const Ray* rays, size_t n, Intersection* results, Object** objects) const
+{
+    for (size_t begin = 0; begin < n; begin += RayPacket::size) {
+        const size_t count = std::min(RayPacket::size, n - begin);
+        std::array<float, RayPacket::size> t_max;
+        for (size_t i = 0; i < count; i++) {
+            objects[begin + i] = nullptr;
+            t_max[i]           = results[begin + i].t;
+        }
+        RayPacket packet;
+        packet.set(rays + begin, count, t_max.data());
+        const size_t n_visited = traverse_packet(nodes, packet, [&](const BVHNode& leaf, int mask) {
+            // gather the rays entering this object and trace them as a smaller packet
+            const Instance& instance = instances[leaf.offset];
+            std::array<Ray, RayPacket::size> active_rays;
+            std::array<Intersection, RayPacket::size> active_results;
+            std::array<size_t, RayPacket::size> lanes;
+            size_t n_active = 0;
+            for (size_t i = 0; i < count; i++) {
+                if ((mask >> i) & 1) {
+                    lanes[n_active]          = i;
+                    active_rays[n_active]    = rays[begin + i];
+                    active_results[n_active] = results[begin + i];
+                    ++n_active;
+                }
+            }
+            if (instance.object->bvh->intersect_n(active_rays.data(), n_active, instance.model,
+                                                  active_results.data()) == 0) {
+                return;
+            }
+            for (size_t j = 0; j < n_active; j++) {
+                const size_t i = lanes[j];
+                if (active_results[j].t < packet.t_max[i]) {
+                    results[begin + i] = active_results[j];
+                    objects[begin + i] = instance.object;
+                    packet.t_max[i]    = active_results[j].t;
+                }
+            }
+        });
+        BVH::traversal_counters.record(count, n_visited, 0);
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef DANDELION_UTILS_TLAS_H
+#define DANDELION_UTILS_TLAS_H
+
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "../scene/group.h"
+#include "bvh.h"
+#include "ray.h"
+
+/*!
+ * \file utils/tlas.h
+ * \ingroup utils
+ * \~chinese
+ * \brief 场景级的两层加速结构。
+ */
+
+/*!
+ * \ingroup utils
+ * \~chinese
+ * \brief 建立在物体世界坐标系包围盒上的顶层 BVH (TLAS) 。
+ *
+ * 每个叶节点对应一个物体，并引用这个物体自己的 BVH （底层 BVH ）。求交时只有射线进入了
+ * 物体的包围盒，才会把射线变换到这个物体的模型坐标系下，在底层 BVH 中继续求交。
+ *
+ * 节点的存储方式与 `BVH` 相同：按深度优先顺序存储，内部节点的左子节点紧跟在它后面。
+ * 物体移动后只需调用 `refit` 自底向上更新包围盒，不需要重新构建整棵树。
+ */
+class TLAS
+{
+public:
+    /*!
+     * \~chinese
+     * \brief 保持 TLAS 与场景一致
+     *
+     * 物体被添加或删除后重新构建整棵树，否则只调用 `refit` 更新物体的变换和包围盒。
+     *
+     * \param groups 场景中所有的物体组
+     */
+    void update(const std::vector<std::unique_ptr<Group>>& groups);
+    /*! \~chinese 为给定的所有物体重新构建 TLAS */
+    void build(const std::vector<std::unique_ptr<Group>>& groups);
+    /*! \~chinese 保持树的拓扑不变，按物体当前的位姿更新所有节点的包围盒 */
+    void refit();
+    /*!
+     * \~chinese
+     * \brief 求射线与场景中所有物体最近的交点
+     *
+     * 可以被多个线程同时调用。
+     *
+     * \param ray 世界坐标系下的射线
+     * \returns 交点（世界坐标系下）和交点所在的物体，不相交时返回 `std::nullopt`
+     */
+    std::optional<std::tuple<Intersection, Object*>> intersect(const Ray& ray) const;
+    /*!
+     * \~chinese
+     * \brief 按射线包批量求交，用于方向相近的主光线和阴影光线
+     *
+     * 每个射线包先遍历 TLAS ，再把进入某个物体包围盒的射线交给这个物体的
+     * `BVH::intersect_n` 。可以被多个线程同时调用。
+     *
+     * \param rays 世界坐标系下的射线
+     * \param n 射线数
+     * \param results 每条射线的交点，初始值应为 `Intersection()` ，没有交点时保持不变
+     * \param objects 每条射线的交点所在的物体，没有交点时为 nullptr
+     */
+    void intersect_n(const Ray* rays, std::size_t n, Intersection* results,
+                     Object** objects) const;
+    /*!
+     * \~chinese
+     * \brief 判断射线在 \f$t \in (0, t_{max})\f$ 的范围内是否被场景中的任何物体遮挡
+     *
+     * 找到第一个遮挡物就立即返回，用于阴影测试。可以被多个线程同时调用。
+     *
+     * \param ray 世界坐标系下的射线
+     * \param t_max 求交范围的上界，通常是到光源的距离
+     */
+    bool occluded(const Ray& ray, float t_max) const;
+
+    /*! \~chinese 按深度优先顺序存储的所有节点，叶节点的 `offset` 是物体在 `instances` 中的序号 */
+    std::vector<BVHNode> nodes;
+
+private:
+    /*! \~chinese 一个物体以及构建或 refit 时它的模型变换矩阵 */
+    struct Instance
+    {
+        Object* object;
+        Eigen::Matrix4f model;
+    };
+
+    /*! \~chinese 更新一个物体的模型变换矩阵，返回它在世界坐标系下的包围盒 */
+    static AABB update_instance(Instance& instance);
+    /*!
+     * \~chinese
+     * \brief 把 `order` 中 \f$[begin, end)\f$ 范围内的物体沿中心包围盒最长的轴等分，
+     * 递归建立子树，返回子树的根节点在 `nodes` 中的序号
+     *
+     * \param order 物体在 `instances` 中的序号，这个范围会被原地重排
+     * \param boxes 每个物体在世界坐标系下的包围盒
+     */
+    std::size_t recursively_build(std::size_t begin, std::size_t end,
+                                  std::vector<std::size_t>& order,
+                                  const std::vector<AABB>& boxes);
+
+    std::vector<Instance> instances;
+};
+
+#endif // DANDELION_UTILS_TLAS_H
@@ -1,10 +1,23 @@
 #include <random>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vector>
 
 #include <catch2/catch_amalgamated.hpp>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
+#include "../src/scene/group.h"
 #include "../src/scene/object.h"
+#include "../src/utils/bvh.h"
+#include "../src/utils/tlas.h"
+#include "../src/utils/thread_pool.h"
 #include "../src/utils/math.hpp"
 #include "../src/utils/formatter.hpp"
 
@@ -15,10 +28,16 @@ using Eigen::Translation3f;
 using Eigen::Vector3f;
 using Eigen::Vector4f;
 using std::default_random_engine;
+using std::optional;
 using std::random_device;
+using std::size_t;
+using std::tuple;
 using std::uniform_real_distribution;
+using std::unique_ptr;
+using std::vector;
 
 constexpr float threshold = 1e-2f;
+constexpr float inf       = std::numeric_limits<float>::infinity();
 
 TEST_CASE("Transformation", "[basic]")
 {
@@ -95,3 +114,501 @@ TEST_CASE("Perspective Projection", "[basic]")
         REQUIRE((reference - answer).norm() < threshold);
     }
 }
+
+// Fill the mesh with randomly placed and oriented small triangles inside [-10, 10]^3, each
+// with its own three vertices.
+void make_triangle_soup(GL::Mesh& mesh, size_t n_faces, unsigned int seed)
+{
+    default_random_engine engine(seed);
+    uniform_real_distribution<float> position(-10.0f, 10.0f);
+    uniform_real_distribution<float> offset(-0.5f, 0.5f);
+    for (size_t i = 0; i < n_faces; ++i) {
+        const Vector3f center(position(engine), position(engine), position(engine));
+        for (int k = 0; k < 3; ++k) {
+            mesh.vertices.append(center.x() + offset(engine), center.y() + offset(engine),
+                                 center.z() + offset(engine));
+        }
+        const unsigned int first = static_cast<unsigned int>(3 * i);
+        mesh.faces.append(first, first + 1, first + 2);
+    }
+}
+
+// A ray starting outside the soup and heading towards a random point inside it.
+Ray random_ray(default_random_engine& engine)
+{
+    uniform_real_distribution<float> target(-8.0f, 8.0f);
+    uniform_real_distribution<float> angle(0.0f, 2.0f * pi<float>());
+    uniform_real_distribution<float> height(-1.0f, 1.0f);
+    const float z     = height(engine);
+    const float phi   = angle(engine);
+    const float r     = std::sqrt(1.0f - z * z);
+    const Vector3f to = Vector3f(target(engine), target(engine), target(engine));
+    const Vector3f from(30.0f * r * std::cos(phi), 30.0f * r * std::sin(phi), 30.0f * z);
+    return Ray{from, (to - from).normalized()};
+}
+
+// Moller-Trumbore intersection without the inside test. Returns t and the smallest
+// barycentric coordinate, which is negative when the ray misses the triangle, or nothing if
+// the ray is parallel with it.
+optional<std::pair<float, float>> ray_face(const Ray& ray, const GL::Mesh& mesh, size_t face)
+{
+    const std::array<size_t, 3> v = mesh.face(face);
+    const Vector3f a              = mesh.vertex(v[0]);
+    const Vector3f e1             = mesh.vertex(v[1]) - a;
+    const Vector3f e2             = mesh.vertex(v[2]) - a;
+    const Vector3f p              = ray.direction.cross(e2);
+    const float det               = e1.dot(p);
+    if (std::abs(det) < 1e-12f) {
+        return std::nullopt;
+    }
+    const Vector3f s = ray.origin - a;
+    const Vector3f q = s.cross(e1);
+    const float u    = s.dot(p) / det;
+    const float v2   = ray.direction.dot(q) / det;
+    const float t    = e2.dot(q) / det;
+    return std::make_pair(t, std::min({u, v2, 1.0f - u - v2}));
+}
+
+// Whether the ray passes so close to an edge of the face that kernels may disagree on it.
+bool grazing(const Ray& ray, const GL::Mesh& mesh, size_t face)
+{
+    const auto hit = ray_face(ray, mesh, face);
+    return !hit.has_value() || std::abs(hit->second) < 1e-4f;
+}
+
+// All intersections with t in [t_min, t_max] found by testing every face, sorted by t.
+vector<Intersection> brute_force_hits(const Ray& ray, const GL::Mesh& mesh, float t_min,
+                                      float t_max)
+{
+    vector<Intersection> hits;
+    for (size_t i = 0; i < mesh.faces.count(); ++i) {
+        const auto hit = ray_face(ray, mesh, i);
+        if (hit.has_value() && hit->second >= 0.0f && hit->first >= t_min &&
+            hit->first <= t_max) {
+            Intersection result;
+            result.t          = hit->first;
+            result.face_index = i;
+            hits.push_back(result);
+        }
+    }
+    std::sort(hits.begin(), hits.end(),
+              [](const Intersection& a, const Intersection& b) { return a.t < b.t; });
+    return hits;
+}
+
+// Check a BVH result against the nearest brute-force hit. Hits on different faces (or a hit
+// on one side only) are accepted only if the nearer one grazes an edge.
+void check_closest_hit(const Ray& ray, const GL::Mesh& mesh, const optional<Intersection>& hit,
+                       const optional<Intersection>& reference)
+{
+    if (!hit.has_value() && !reference.has_value()) {
+        return;
+    }
+    if (hit.has_value() && reference.has_value() &&
+        (hit->face_index == reference->face_index || std::abs(hit->t - reference->t) < 1e-4f)) {
+        REQUIRE(std::abs(hit->t - reference->t) < 1e-3f);
+        return;
+    }
+    const Intersection& nearer =
+        !hit.has_value() || (reference.has_value() && reference->t < hit->t) ? *reference : *hit;
+    INFO(fmt::format("hit face {} at t = {:.4f} is not confirmed", nearer.face_index, nearer.t));
+    REQUIRE(grazing(ray, mesh, nearer.face_index));
+}
+
+TEST_CASE("BVH Closest Hit", "[bvh]")
+{
+    GL::Mesh mesh;
+    make_triangle_soup(mesh, 4096, 1);
+    BVH bvh(mesh);
+    bvh.build();
+    default_random_engine engine(2);
+    INFO(fmt::format("BVH width is {}", bvh_width));
+    for (int i = 0; i < 256; ++i) {
+        const Ray ray                 = random_ray(engine);
+        const vector<Intersection> bf = brute_force_hits(ray, mesh, 0.0f, inf);
+        const optional<Intersection> reference =
+            bf.empty() ? std::nullopt : optional<Intersection>(bf.front());
+        // the binary tree is always kept, and `intersect` walks the BVH of the configured width
+        check_closest_hit(ray, mesh, bvh.ray_node_intersect(0, ray), reference);
+        check_closest_hit(ray, mesh, bvh.intersect(ray, mesh, I4f), reference);
+    }
+}
+
+TEST_CASE("BVH All Hits", "[bvh]")
+{
+    GL::Mesh mesh;
+    make_triangle_soup(mesh, 4096, 3);
+    BVH bvh(mesh);
+    bvh.build();
+    default_random_engine engine(4);
+    for (int i = 0; i < 256; ++i) {
+        const Ray ray = random_ray(engine);
+        vector<Intersection> hits;
+        bvh.intersect_all(ray, I4f, 10.0f, 50.0f, [&hits](const Intersection& hit) {
+            hits.push_back(hit);
+            return true;
+        });
+        for (size_t j = 1; j < hits.size(); ++j) {
+            REQUIRE(hits[j - 1].t <= hits[j].t);
+        }
+        // faces grazed by the ray may be reported by either side only
+        const auto is_grazing = [&](const Intersection& hit) {
+            return grazing(ray, mesh, hit.face_index);
+        };
+        vector<Intersection> reference = brute_force_hits(ray, mesh, 10.0f, 50.0f);
+        hits.erase(std::remove_if(hits.begin(), hits.end(), is_grazing), hits.end());
+        reference.erase(std::remove_if(reference.begin(), reference.end(), is_grazing),
+                        reference.end());
+        REQUIRE(hits.size() == reference.size());
+        for (size_t j = 0; j < hits.size(); ++j) {
+            REQUIRE(std::abs(hits[j].t - reference[j].t) < 1e-3f);
+        }
+    }
+}
+
+TEST_CASE("BVH Nearest Vertex and Edge", "[bvh]")
+{
+    GL::Mesh mesh;
+    make_triangle_soup(mesh, 4096, 5);
+    BVH bvh(mesh);
+    bvh.build();
+    default_random_engine engine(6);
+    uniform_real_distribution<float> position(-10.0f, 10.0f);
+    constexpr float radius = 0.5f;
+    for (int i = 0; i < 256; ++i) {
+        const Vector3f point(position(engine), position(engine), position(engine));
+        float vertex_distance = inf;
+        float edge_distance   = inf;
+        for (size_t face = 0; face < mesh.faces.count(); ++face) {
+            const std::array<size_t, 3> v = mesh.face(face);
+            for (int k = 0; k < 3; ++k) {
+                const Vector3f a    = mesh.vertex(v[k]);
+                const Vector3f edge = mesh.vertex(v[(k + 1) % 3]) - a;
+                const float s   = clamp(0.0f, 1.0f, (point - a).dot(edge) / edge.squaredNorm());
+                vertex_distance = std::min(vertex_distance, (point - a).norm());
+                edge_distance   = std::min(edge_distance, (point - (a + s * edge)).norm());
+            }
+        }
+        const optional<Proximity> vertex = bvh.nearest_vertex(point, radius);
+        const optional<Proximity> edge   = bvh.nearest_edge(point, radius);
+        if (std::abs(vertex_distance - radius) > 1e-4f) {
+            REQUIRE(vertex.has_value() == (vertex_distance < radius));
+        }
+        if (vertex.has_value()) {
+            const Vector3f found = mesh.vertex(mesh.face(vertex->face_index)[vertex->element]);
+            REQUIRE(std::abs(vertex->distance - vertex_distance) < 1e-4f);
+            REQUIRE(std::abs((found - point).norm() - vertex_distance) < 1e-4f);
+        }
+        if (std::abs(edge_distance - radius) > 1e-4f) {
+            REQUIRE(edge.has_value() == (edge_distance < radius));
+        }
+        if (edge.has_value()) {
+            REQUIRE(std::abs(edge->distance - edge_distance) < 1e-4f);
+            REQUIRE(std::abs((edge->point - point).norm() - edge_distance) < 1e-4f);
+        }
+    }
+}
+
+TEST_CASE("BVH Refit", "[bvh]")
+{
+    GL::Mesh mesh;
+    make_triangle_soup(mesh, 4096, 7);
+    BVH bvh(mesh);
+    bvh.build();
+    default_random_engine engine(8);
+    uniform_real_distribution<float> offset(-0.05f, 0.05f);
+    for (float& coordinate : mesh.vertices.data) {
+        coordinate += offset(engine);
+    }
+    REQUIRE(bvh.refit());
+
+    // every box of the refitted tree is tight around its children or faces
+    for (size_t i = 0; i < bvh.nodes.size(); ++i) {
+        const BVHNode& node = bvh.nodes[i];
+        AABB expected;
+        if (node.n_primitives > 0) {
+            for (size_t j = node.offset; j < node.offset + node.n_primitives; ++j) {
+                for (size_t v : mesh.face(bvh.primitives[j])) {
+                    expected = union_AABB(expected, mesh.vertex(v));
+                }
+            }
+        } else {
+            expected = union_AABB(bvh.nodes[i + 1].aabb, bvh.nodes[node.offset].aabb);
+        }
+        REQUIRE((node.aabb.p_min - expected.p_min).norm() < 1e-5f);
+        REQUIRE((node.aabb.p_max - expected.p_max).norm() < 1e-5f);
+    }
+    BVH rebuilt(mesh);
+    rebuilt.build();
+    REQUIRE((bvh.nodes.front().aabb.p_min - rebuilt.nodes.front().aabb.p_min).norm() < 1e-5f);
+    REQUIRE((bvh.nodes.front().aabb.p_max - rebuilt.nodes.front().aabb.p_max).norm() < 1e-5f);
+    default_random_engine ray_engine(9);
+    for (int i = 0; i < 64; ++i) {
+        const Ray ray                    = random_ray(ray_engine);
+        const optional<Intersection> hit = rebuilt.intersect(ray, mesh, I4f);
+        check_closest_hit(ray, mesh, bvh.intersect(ray, mesh, I4f), hit);
+    }
+
+    // a face is added, so the tree has to be rebuilt
+    mesh.vertices.append(0.0f, 0.0f, 0.0f);
+    mesh.faces.append(0u, 1u, static_cast<unsigned int>(mesh.vertices.count() - 1));
+    REQUIRE_FALSE(bvh.refit());
+}
+
+TEST_CASE("BVH Cache", "[bvh]")
+{
+    namespace fs           = std::filesystem;
+    const fs::path path    = fs::temp_directory_path() / "dandelion_test.bvh";
+    const fs::path damaged = fs::temp_directory_path() / "dandelion_test_damaged.bvh";
+    GL::Mesh mesh;
+    make_triangle_soup(mesh, 4096, 10);
+    BVH bvh(mesh);
+    bvh.build();
+    REQUIRE(bvh.save(path.string()));
+
+    BVH loaded(mesh);
+    REQUIRE(loaded.load(path.string()));
+    REQUIRE(loaded.nodes.size() == bvh.nodes.size());
+    for (size_t i = 0; i < bvh.nodes.size(); ++i) {
+        REQUIRE(loaded.nodes[i].aabb.p_min == bvh.nodes[i].aabb.p_min);
+        REQUIRE(loaded.nodes[i].aabb.p_max == bvh.nodes[i].aabb.p_max);
+        REQUIRE(loaded.nodes[i].offset == bvh.nodes[i].offset);
+        REQUIRE(loaded.nodes[i].n_primitives == bvh.nodes[i].n_primitives);
+    }
+    REQUIRE(loaded.primitives == bvh.primitives);
+    REQUIRE(loaded.depth == bvh.depth);
+
+    // a truncated file is rejected and the tree is left as it was
+    {
+        std::ifstream input(path, std::ios::binary);
+        vector<char> bytes((std::istreambuf_iterator<char>(input)),
+                           std::istreambuf_iterator<char>());
+        std::ofstream output(damaged, std::ios::binary);
+        output.write(bytes.data(), static_cast<std::streamsize>(bytes.size() - 16));
+    }
+    BVH truncated(mesh);
+    REQUIRE_FALSE(truncated.load(damaged.string()));
+    REQUIRE(truncated.nodes.empty());
+
+    // the same number of faces but a moved vertex gives a different mesh hash
+    GL::Mesh moved;
+    make_triangle_soup(moved, 4096, 10);
+    moved.vertices.data[0] += 1.0f;
+    REQUIRE(BVH::mesh_hash(moved) != BVH::mesh_hash(mesh));
+    BVH stale(moved);
+    REQUIRE_FALSE(stale.load(path.string()));
+    REQUIRE(stale.nodes.empty());
+
+    fs::remove(path);
+    fs::remove(damaged);
+}
+
+TEST_CASE("BVH Parallel Build", "[bvh]")
+{
+    // large enough for the root and both of its children to be built in parallel
+    GL::Mesh mesh;
+    make_triangle_soup(mesh, 2 * BVH::parallel_threshold + 4096, 11);
+    BVH parallel(mesh);
+    parallel.parallel_build = true;
+    parallel.build();
+    BVH serial(mesh);
+    serial.parallel_build = false;
+    serial.build();
+
+    // subtrees built in parallel are spliced in the serial order, so the trees are identical
+    REQUIRE(parallel.nodes.size() == serial.nodes.size());
+    for (size_t i = 0; i < serial.nodes.size(); ++i) {
+        REQUIRE(parallel.nodes[i].aabb.p_min == serial.nodes[i].aabb.p_min);
+        REQUIRE(parallel.nodes[i].aabb.p_max == serial.nodes[i].aabb.p_max);
+        REQUIRE(parallel.nodes[i].offset == serial.nodes[i].offset);
+        REQUIRE(parallel.nodes[i].n_primitives == serial.nodes[i].n_primitives);
+        REQUIRE(parallel.nodes[i].axis == serial.nodes[i].axis);
+    }
+    REQUIRE(parallel.primitives == serial.primitives);
+    REQUIRE(parallel.depth == serial.depth);
+    default_random_engine engine(12);
+    for (int i = 0; i < 256; ++i) {
+        const Ray ray                         = random_ray(engine);
+        const optional<Intersection> hit      = parallel.intersect(ray, mesh, I4f);
+        const optional<Intersection> expected = serial.intersect(ray, mesh, I4f);
+        REQUIRE(hit.has_value() == expected.has_value());
+        if (hit.has_value()) {
+            REQUIRE(hit->face_index == expected->face_index);
+            REQUIRE(hit->t == expected->t);
+        }
+    }
+}
+
+// A group of four triangle soups with different centers, scalings and rotations, whose world
+// space boxes overlap.
+void make_test_scene(vector<unique_ptr<Group>>& groups)
+{
+    const Vector3f centers[4]  = {Vector3f(-5.0f, 0.0f, 0.0f), Vector3f(5.0f, 0.0f, 0.0f),
+                                  Vector3f(0.0f, 5.0f, -3.0f), Vector3f(0.0f, -4.0f, 4.0f)};
+    const Vector3f scalings[4] = {Vector3f(0.4f, 0.4f, 0.4f), Vector3f(0.5f, 0.3f, 0.6f),
+                                  Vector3f(0.3f, 0.6f, 0.4f), Vector3f(0.5f, 0.5f, 0.2f)};
+    groups.push_back(std::make_unique<Group>("test group"));
+    for (unsigned int i = 0; i < 4; ++i) {
+        auto object = std::make_unique<Object>(fmt::format("test object {}", i));
+        make_triangle_soup(object->mesh, 1024, 20 + i);
+        object->center   = centers[i];
+        object->scaling  = scalings[i];
+        object->rotation = AngleAxisf(0.5f * static_cast<float>(i), Vector3f::UnitY());
+        object->rebuild_BVH();
+        groups.front()->objects.push_back(std::move(object));
+    }
+}
+
+// The closest hit in the scene found by intersecting the BVH of every object in turn.
+optional<tuple<Intersection, Object*>> closest_object_hit(const Ray& ray,
+                                                          const vector<unique_ptr<Group>>& groups)
+{
+    optional<Intersection> closest;
+    Object* closest_object = nullptr;
+    for (const auto& group : groups) {
+        for (const auto& object : group->objects) {
+            const optional<Intersection> hit =
+                object->bvh->intersect(ray, object->mesh, object->model());
+            if (hit.has_value() && (!closest.has_value() || hit->t < closest->t)) {
+                closest        = hit;
+                closest_object = object.get();
+            }
+        }
+    }
+    if (!closest.has_value()) {
+        return std::nullopt;
+    }
+    return std::make_tuple(*closest, closest_object);
+}
+
+TEST_CASE("TLAS Closest Hit", "[bvh]")
+{
+    vector<unique_ptr<Group>> groups;
+    make_test_scene(groups);
+    TLAS tlas;
+    tlas.update(groups);
+    default_random_engine engine(24);
+    const auto check_rays = [&]() {
+        for (int i = 0; i < 256; ++i) {
+            const Ray ray                                    = random_ray(engine);
+            const optional<tuple<Intersection, Object*>> hit = tlas.intersect(ray);
+            const optional<tuple<Intersection, Object*>> expected =
+                closest_object_hit(ray, groups);
+            REQUIRE(hit.has_value() == expected.has_value());
+            if (hit.has_value()) {
+                REQUIRE(std::get<1>(*hit) == std::get<1>(*expected));
+                REQUIRE(std::get<0>(*hit).face_index == std::get<0>(*expected).face_index);
+                REQUIRE(std::get<0>(*hit).t == std::get<0>(*expected).t);
+            }
+        }
+    };
+    check_rays();
+
+    // moving an object keeps the set of objects, so the TLAS is refitted instead of rebuilt
+    const size_t n_nodes = tlas.nodes.size();
+    Object& moved        = *groups.front()->objects[1];
+    moved.center += Vector3f(-7.0f, 2.0f, 1.0f);
+    tlas.update(groups);
+    REQUIRE(tlas.nodes.size() == n_nodes);
+    const AABB moved_box = moved.world_AABB().value();
+    const AABB& root     = tlas.nodes.front().aabb;
+    REQUIRE(root.p_min.cwiseMin(moved_box.p_min) == root.p_min);
+    REQUIRE(root.p_max.cwiseMax(moved_box.p_max) == root.p_max);
+    check_rays();
+}
+
+// A batch of rays from one origin towards points around the target, like the primary rays of
+// a tile.
+vector<Ray> coherent_rays(default_random_engine& engine, const Vector3f& target, size_t n)
+{
+    uniform_real_distribution<float> jitter(-1.5f, 1.5f);
+    const Vector3f origin = random_ray(engine).origin;
+    vector<Ray> rays(n);
+    for (Ray& ray : rays) {
+        const Vector3f to = target + Vector3f(jitter(engine), jitter(engine), jitter(engine));
+        ray               = Ray{origin, (to - origin).normalized()};
+    }
+    return rays;
+}
+
+TEST_CASE("BVH and TLAS Ray Packets", "[bvh]")
+{
+    vector<unique_ptr<Group>> groups;
+    make_test_scene(groups);
+    TLAS tlas;
+    tlas.update(groups);
+    // one full packet and one with only 5 of its lanes in use
+    constexpr size_t n_rays = 13;
+    default_random_engine engine(25);
+    for (int i = 0; i < 64; ++i) {
+        Object& object         = *groups.front()->objects[i % 4];
+        const Matrix4f model   = object.model();
+        const vector<Ray> rays = coherent_rays(engine, object.center, n_rays);
+        vector<Intersection> object_results(n_rays, Intersection());
+        object.bvh->intersect_n(rays.data(), n_rays, model, object_results.data());
+        vector<Intersection> scene_results(n_rays, Intersection());
+        vector<Object*> objects(n_rays, nullptr);
+        tlas.intersect_n(rays.data(), n_rays, scene_results.data(), objects.data());
+        for (size_t j = 0; j < n_rays; ++j) {
+            const optional<Intersection> hit = object.bvh->intersect(rays[j], object.mesh, model);
+            REQUIRE(hit.has_value() == (object_results[j].t != Intersection().t));
+            if (hit.has_value()) {
+                REQUIRE(object_results[j].face_index == hit->face_index);
+                REQUIRE(object_results[j].t == hit->t);
+            }
+            const optional<tuple<Intersection, Object*>> scene_hit = tlas.intersect(rays[j]);
+            REQUIRE(scene_hit.has_value() == (objects[j] != nullptr));
+            if (scene_hit.has_value()) {
+                REQUIRE(objects[j] == std::get<1>(*scene_hit));
+                REQUIRE(scene_results[j].face_index == std::get<0>(*scene_hit).face_index);
+                REQUIRE(scene_results[j].t == std::get<0>(*scene_hit).t);
+            }
+        }
+    }
+}
+
+TEST_CASE("BVH and TLAS Occlusion", "[bvh]")
+{
+    vector<unique_ptr<Group>> groups;
+    make_test_scene(groups);
+    TLAS tlas;
+    tlas.update(groups);
+    default_random_engine engine(26);
+    for (int i = 0; i < 64; ++i) {
+        Object& object       = *groups.front()->objects[i % 4];
+        const Matrix4f model = object.model();
+        for (const Ray& ray : coherent_rays(engine, object.center, 4)) {
+            // the closest hit bounds the range in which the ray is blocked
+            const optional<Intersection> hit = object.bvh->intersect(ray, object.mesh, model);
+            if (hit.has_value()) {
+                REQUIRE_FALSE(object.bvh->occluded(ray, model, 0.999f * hit->t));
+                REQUIRE(object.bvh->occluded(ray, model, 1.001f * hit->t));
+            } else {
+                REQUIRE_FALSE(object.bvh->occluded(ray, model, inf));
+            }
+            const optional<tuple<Intersection, Object*>> scene_hit = tlas.intersect(ray);
+            if (scene_hit.has_value()) {
+                const float t = std::get<0>(*scene_hit).t;
+                REQUIRE_FALSE(tlas.occluded(ray, 0.999f * t));
+                REQUIRE(tlas.occluded(ray, 1.001f * t));
+            } else {
+                REQUIRE_FALSE(tlas.occluded(ray, inf));
+            }
+        }
+    }
+}
+
+TEST_CASE("Thread Pool Parallel For", "[basic]")
+{
+    ThreadPool pool(4);
+    constexpr size_t n = 10000;
+    vector<std::atomic<int>> counts(n);
+    for (auto& count : counts) {
+        count = 0;
+    }
+    pool.parallel_for(n, [&counts](size_t i) { ++counts[i]; });
+    for (size_t i = 0; i < n; ++i) {
+        INFO(fmt::format("index {}", i));
+        REQUIRE(counts[i] == 1);
+    }
+}